@@ -1,177 +1,490 @@
-#include <iostream>
-#include <fstream>
-#include <unistd.h>
-#include <string>
-#include <cmath>
-#include <pthread.h>
-#include <time.h>
-
-using namespace std;
-
-//height and width of 2D arrays
-#define ARRAY_WIDTH 1000
-#define ARRAY_HEIGHT 50000
-
-//horizontal distance between heights stored in each row of main array
-//remains the same between every point and its immediate neighbours in row
-//so long as this value is constant, its actual number value is unimportant
-#define HORIZONTAL_POINT_DIST 50
-
-//number of threads to split array between
-#define NUM_THREADS 50000
-
-//used to convert return value of asin() from radians to degrees
-#define DEGREES_PER_RADIAN 57.2958
-
-//a pointer to an object of this type will be passed to the thread function as a parameter whenever a thread is created
-//a different object will be given to each thread - this is the easiest way to avoid a race condition when different threads
-//are reading/writing to the currentRow and rowsToProcess member variables
-struct ThreadData
-{	
-	float** mainArray;
-	float** distanceArray;
-	float** angleArray;
-	
-	int currentRow;
-	int rowsToProcess;
-	
-	//used by a thread to return back to main function the time it took to complete (return value accessed through pthread_join())
-	//the only way a value can be returned from a thread is using a void pointer
-	//however, returning a pointer to local storage of a terminated thread will cause an access violation
-	//therefore, variable is stored locally in main instead
-	float timeTaken;
-};
-
-//remove
-void compareArrayValues(float** mainArray, float** resultArray, int height, int width);
-//remove
-
-float** setupMainArray(void); //used for importing and converting data for main array from array.txt and storing it in main array
-template <typename type> type** setup2DArrayOnHeap(void); //templated function to setup a 2D array on heap (must allocate arrays on heap due to their large size)
-template <typename type> void delete2DArray(type** array); //templated function to release memory used for a given 2D array (must be called for each array)
+//cw1Part3 is built from every cw1Part3*.cpp file together, e.g.
+//g++ -O2 -march=native -pthread cw1Part3*.cpp -o cw1Part3
+//(adding -fopenmp, -DUSE_STD_EXECUTION -ltbb, -DUSE_LZ4 -llz4 and -DUSE_ZSTD -lzstd for the optional backends and codecs)
+#include "cw1Part3.h"
+#include "cw1Part3Trace.h"
+#include "cw1Part3Telemetry.h"
+#include "cw1Part3Segments.h"
+#include "cw1Part3Regions.h"
+#include "cw1Part3Pyramid.h"
+#include "cw1Part3Tokenizer.h"
+#include "cw1Part3Stream.h"
+#include "cw1Part3Roofline.h"
+#include "cw1Part3OutOfCore.h"
+#include "cw1Part3Batch.h"
+#include "cw1Part3Shards.h"
+#include "cw1Part3Compression.h"
 
-//thread function - takes a ThreadData pointer (which must be passed into the function as a void pointer)
-void* processRows(void* data);
+//globals declared in cw1Part3.h
+RunOptions options;
+size_t floatRowStride;
+double prefaultTime = 0;
+atomic<int> nextChunkRow(0);
+int chunkEndRow = 0;
+const char* layoutNames[] = { "planes", "interleaved", "blocked" };
+const char* backendNames[] = { "pthreads", "openmp-static", "openmp-dynamic", "par", "pool" };
+SlopeEntry* slopeTable = NULL;
 
-int main ()
+int main (int argc, char* argv[])
 {	
 	//create a clock object and set it equal to current processor time used by this process (measured in clock ticks)
 	clock_t startTime = clock();
 	
+	//read run-time options (huge pages, pre-faulting) from the command line
+	if (!parseOptions(argc, argv))
+		return 1;
+	
+	//worker processes are given the coordinator's options, but only the coordinator reports on the run as a whole
+	if (options.shardWorker.empty())
+		startTelemetry();
+	else
+		options.telemetryInterval = 0;
+	
+	//in parser benchmark mode, only loading is timed - no processing is done
+	if (options.parseBenchmark)
+	{
+		benchmarkParsers();
+		return 0;
+	}
+	
+	//in calibration mode, trials are run on generated data and the results saved - array.txt is not needed
+	if (options.calibrate)
+	{
+		calibrate();
+		return 0;
+	}
+	
+	//the roofline benchmark also works on generated data
+	if (options.roofline)
+	{
+		runRoofline();
+		return 0;
+	}
+	
+	//previews only read a pyramid level from a results file that has already been written
+	if (!options.previewPath.empty())
+	{
+		previewResults();
+		return 0;
+	}
+	
+	//conversion writes array.txt out as a binary grid, which out-of-core runs can then map instead of parsing
+	if (!options.convertPath.empty())
+	{
+		convertToGridFile();
+		return 0;
+	}
+	
+	//out-of-core runs take their dimensions from the grid file and never hold the whole grid in memory
+	if (!options.outOfCorePath.empty())
+	{
+		processOutOfCore();
+		return 0;
+	}
+	
+	//worker processes are started by a coordinator, which passes them the same options along with --shard-worker
+	if (!options.shardWorker.empty())
+	{
+		runShardWorker();
+		return 0;
+	}
+	
+	if (!options.shardedPath.empty())
+	{
+		runShardCoordinator(argc, argv);
+		return 0;
+	}
+	
+	//streams have no fixed height - rows are processed as they arrive until the input ends
+	if (!options.streamPath.empty())
+	{
+		processStream();
+		return 0;
+	}
+	
+	//batch runs also take their dimensions from the grid files, and process each of them in turn
+	if (!options.batchPath.empty())
+	{
+		processBatch();
+		return 0;
+	}
+	
 	//make sure that number of threads requested is not greater than the number of rows in the array
 	//if it is, then terminate program (because otherwise useless threads will be created)
-	if (NUM_THREADS > ARRAY_HEIGHT)
+	if (!options.inputPath.empty() && !readInputDimensions())
+		return 1;
+	
+	if (options.numThreads > options.arrayHeight)
 	{
 		cout << "Error! Number of threads requested is greater than the number of rows in the array." << endl;
 		return 1;
 	}
 	
+	//start counting dTLB misses before any grids are allocated so that every thread created later is included
+	startMemoryCounters();
+	MemoryCounters allocStartCounters = readMemoryCounters();
+	
+	traceThread("main");
+	
 	//double-pointers used to point to 2D arrays
 	//the 2D arrays created have been set up on the heap due to their large size (and so they can be shared between threads)
-	float** mainArray = setupMainArray();
-	float** distanceArray = setup2DArrayOnHeap<float>();
-	float** angleArray = setup2DArrayOnHeap<float>();
+	setTelemetryPhase("loading", 0);
+	uint64_t traceStart = traceTimestamp();
+	float** mainArray = options.inputPath.empty() ? setupMainArray() : loadHeights(options.inputPath);
+	traceSpan("load", traceStart, traceTimestamp());
+	
+	traceStart = traceTimestamp();
+	ResultGrid results = setupResultGrid(options.layout);
+	traceSpan("allocate", traceStart, traceTimestamp());
 	
 	//calculate and output elapsed time
 	clock_t arrayAllocTime = clock() - startTime;
 	float time = ((float)arrayAllocTime / (float)CLOCKS_PER_SEC);
 	cout << "Allocation of arrays on the heap takes " << time << " seconds.\n";
 	
+	//the grids were pre-faulted by the allocator, before the heights were parsed into them
+	if (options.prefault)
+		cout << "Pre-faulting of the heights and result arrays takes " << prefaultTime << " seconds.\n";
+	
+	MemoryCounters allocEndCounters = readMemoryCounters();
+	printMemoryCounters("loading and allocation", allocStartCounters, allocEndCounters);
+	
 	//pack array pointers and other data into structs (for passing in to thread function)
 	//each thread will receive a separate copy of this data - this is the easiest way to avoid
 	//race conditions when different threads are reading and writing to the struct's currentRow and rowsToProcess members
-	ThreadData data[NUM_THREADS];
+	ThreadData* data = new ThreadData[options.numThreads];
+	int numThreads = options.numThreads;
+	
+	//pick the kernel that matches this run's dimensions most closely
+	bool specialisedKernel;
+	RowRangeKernel kernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialisedKernel);
+	if (options.kernelMode != KERNEL_LOOKUP)
+		cout << "Using " << (specialisedKernel ? "specialised" : "generic") << " " << (options.doublePrecision ? "double" : "single")
+			<< " precision math kernel for width " << options.arrayWidth << " and spacing " << options.pointSpacing << ".\n";
 	
 	//initialise members of ThreadData objects
-	for (int i = 0; i < NUM_THREADS; i++)
+	for (int i = 0; i < numThreads; i++)
 	{
+		data[i].kernel = kernel;
+		data[i].threadIndex = i;
+		data[i].traceBuffer = NULL;
 		data[i].mainArray = mainArray;
-		data[i].distanceArray = distanceArray;
-		data[i].angleArray = angleArray;
+		data[i].results = results;
 		data[i].currentRow = 0;
 	}
 
-	//split up rows equally between threads and store results in rowsToProcess
-	int rowsToProcess = ARRAY_HEIGHT / NUM_THREADS;
+	//split up rows between threads, giving each thread a contiguous range starting at currentRow
+	partitionRows(data, numThreads, 0, options.arrayHeight);
 	
-	//store number of rows that could not be split up equally between threads
-	//each thread created will be allocated one of these rows in addition to its normal workload (until no remainder rows are left)
-	int remainderRows = ARRAY_HEIGHT % NUM_THREADS;
+	//create required number of thread identifiers
+	pthread_t* threads = new pthread_t[numThreads];
 	
-	//keeps track of current row in array so this data can be passed to threads
-	int currentRow = 0;
+	//work out which kernels and kinds of store to try - usually one of each, but both if a comparison has been requested
+	RowRangeKernel kernelRuns[2];
+	const char* kernelNames[2];
+	int numKernelRuns = 0;
 	
-	//create required number of thread identifiers
-	pthread_t threads[NUM_THREADS];
+	if (options.kernelMode != KERNEL_LOOKUP)
+	{
+		kernelNames[numKernelRuns] = "math";
+		kernelRuns[numKernelRuns++] = kernel;
+	}
+	if (options.kernelMode != KERNEL_MATH)
+	{
+		//the table is shared read-only between every thread, so it is built once before any processing starts
+		traceStart = traceTimestamp();
+		buildSlopeTable();
+		traceSpan("build lookup table", traceStart, traceTimestamp());
+		
+		kernelNames[numKernelRuns] = "lookup";
+		kernelRuns[numKernelRuns++] = processRowRangeLookup;
+	}
+	
+	bool storeRuns[2];
+	int numStoreRuns = 0;
 	
-	//for each thread to be created, set its data parameters and create it, passing in the data
-	for (int i = 0; i < NUM_THREADS; i++)
+	if (rowsReadBack() && options.stores != STORES_NORMAL && options.stores != STORES_AUTO)
+		cout << "Using normal stores only, as segments or the pyramid are picked out of each row of results straight after it is written.\n";
+	
+	if (options.stores == STORES_BOTH && !rowsReadBack())
 	{
-		data[i].currentRow = currentRow;
+		storeRuns[numStoreRuns++] = false;
+		storeRuns[numStoreRuns++] = true;
+	}
+	else
+		storeRuns[numStoreRuns++] = useStreamingStores(options.stores);
+	
+	//the pool, OpenMP and par backends are compared with one thread per usable CPU at most, as the default thread count is
+	//far more than any of them can run at once (the pthreads backend keeps the thread count it was given)
+	int backendThreads = min(numThreads, availableCpuCount());
+	
+	//the pool backend's threads are created once and wait at a barrier between runs - a pool thread with no rows
+	//would have nothing to wait for, so there are never more of them than rows
+	//they have identifiers of their own, as the pthreads backend reuses the threads array for each of its runs
+	int poolThreads = min(backendThreads, options.arrayHeight);
+	bool usePool = find(options.backends.begin(), options.backends.end(), BACKEND_POOL) != options.backends.end();
+	pthread_t* poolThreadIds = new pthread_t[poolThreads];
+	
+	if (usePool)
+		startThreadPool(data, poolThreadIds, poolThreads);
+	
+	//wall-clock time of every run, so the fastest combination of backend, kernel and stores can be picked out at the end
+	int runsPerBackend = numKernelRuns * numStoreRuns;
+	int numRuns = (int)options.backends.size() * runsPerBackend;
+	vector<double> runTimes(numRuns);
+	vector<int> runThreadCounts(numRuns);
+	
+	setTelemetryPhase("processing", (uint64_t)numRuns * options.arrayHeight);
+	
+	//segments picked out during the most recent run, if any are being picked out
+	bool collectingSegments = options.topSegments > 0 || options.steeperThan >= 0;
+	vector<SlopeSegment> steepestSegments;
+	vector<SlopeSegment> segmentHits;
+	
+	//the pyramid is built by whichever threads complete its rows, so it is rebuilt by every run
+	Pyramid pyramid;
+	pyramid.levels = 0;
+	
+	if (options.pyramidLevels > 0)
+	{
+		setupPyramid(pyramid, options.arrayHeight, options.arrayWidth, options.pyramidLevels);
+		activePyramid = &pyramid;
+	}
+	
+	//each point reads one float from mainArray and writes a distance and an angle (whatever the layout)
+	double bytesMoved = (double)options.arrayHeight * options.arrayWidth * sizeof(float) * 3;
+	
+	for (int run = 0; run < numRuns; run++)
+	{
+		Backend backend = options.backends[run / runsPerBackend];
+		int kernelRun = (run % runsPerBackend) / numStoreRuns;
+		int storeRun = run % numStoreRuns;
+		int runThreads = backend == BACKEND_POOL ? poolThreads : (backend == BACKEND_PTHREADS ? numThreads : backendThreads);
 		
-		//give one of the extra rows to each thread in turn until all rows have been assigned to a thread
-		if (remainderRows != 0)
+		for (int i = 0; i < numThreads; i++)
 		{
-			data[i].rowsToProcess = rowsToProcess + 1;
-			remainderRows--;
-			currentRow += rowsToProcess + 1;
+			data[i].kernel = kernelRuns[kernelRun];
+			data[i].streamingStores = storeRuns[storeRun];
+			data[i].lookupFallbackRows = 0;
+		}
+		
+		//row ranges are handed out again for every run (threads taking chunks dynamically change them as they go)
+		partitionRows(data, runThreads, 0, options.arrayHeight);
+		
+		if (activePyramid != NULL)
+			resetPyramid(pyramid);
+		
+		MemoryCounters runStartCounters = readMemoryCounters();
+		
+		//wall-clock start of processing, used to work out the memory bandwidth achieved by the threads together
+		double processingStart = wallTime();
+		uint64_t runTraceStart = traceTimestamp();
+		
+		if (backend == BACKEND_PTHREADS)
+		{
+			//for each thread to be created, create it, passing in its data
+			for (int i = 0; i < numThreads; i++)
+				pthread_create(&threads[i], NULL, processRows, (void*)&data[i]);
+			
+			//calculate elapsed time from start to the point straight after the threads have been created
+			clock_t threadCreationTime = clock() - startTime;
+			time = ((float)threadCreationTime / (float)CLOCKS_PER_SEC);
+			cout << "Up to point where threads are joined, program has taken " << time << " seconds.\n";
+			
+			//set up void pointer to hold thread return value
+			void* threadReturnVal;
+			cout << "Thread run-time data:\n";
+			
+			//join each thread back into parent thread, printing out each thread's time to completion
+			uint64_t joinTraceStart = traceTimestamp();
+			
+			for (int i = 0; i < numThreads; i++)
+			{
+				pthread_join(threads[i], &threadReturnVal);
+				cout << "Thread " << i << " completed in " << ((ThreadData*)threadReturnVal)->timeTaken << " seconds.\n";		
+			}
+			
+			runTimes[run] = wallTime() - processingStart;
+			uint64_t runTraceEnd = traceTimestamp();
+			
+			traceSpan("join", joinTraceStart, runTraceEnd);
+			traceSpan("processing run", runTraceStart, runTraceEnd);
+			
+			//each thread was idle from the moment it finished until the last thread finished and it could be joined
+			//(all threads have been joined, so their buffers can safely be written to from here)
+			for (int i = 0; i < numThreads; i++)
+				if (data[i].traceBuffer != NULL)
+					traceSpanIn(data[i].traceBuffer, "idle", data[i].finishTicks, runTraceEnd);
+			
+			//measure time taken to join the threads back together
+			clock_t postThreadJoinTime = clock() - threadCreationTime;
+			time = ((float)postThreadJoinTime / (float)CLOCKS_PER_SEC);
+			cout << "Joining of threads takes " << time << " seconds.\n";
 		}
-		//once extra rows have been dealt with, use else block to allocate each thread the normal number of rows to process
 		else
 		{
-			data[i].rowsToProcess = rowsToProcess;
-			currentRow += rowsToProcess;
+			if (backend == BACKEND_POOL)
+			{
+				releaseThreadPool();
+				waitForThreadPool();
+			}
+			else
+				runThreads = processRowsWithBackend(backend, data, runThreads);
+			
+			runTimes[run] = wallTime() - processingStart;
+			uint64_t runTraceEnd = traceTimestamp();
+			traceSpan("processing run", runTraceStart, runTraceEnd);
+			
+			//these backends' threads outlive the run, so each thread's time is the wall-clock time until it finished its rows
+			if (backend == BACKEND_PAR)
+				cout << "The par loop completed in " << data[0].timeTaken << " seconds.\n";
+			else
+			{
+				cout << "Thread run-time data:\n";
+				
+				for (int i = 0; i < runThreads; i++)
+				{
+					cout << "Thread " << i << " finished its rows " << data[i].timeTaken << " seconds into the run.\n";
+					if (data[i].traceBuffer != NULL)
+						traceSpanIn(data[i].traceBuffer, "idle", data[i].finishTicks, runTraceEnd);
+				}
+			}
 		}
 		
-		pthread_create(&threads[i], NULL, processRows, (void*)&data[i]);
+		double processingTime = runTimes[run];
+		runThreadCounts[run] = runThreads;
+		cout << "Processing with the " << backendNames[backend] << " backend on " << runThreads << " threads, " << kernelNames[kernelRun] << " kernel, "
+			<< (storeRuns[storeRun] ? "streaming" : "normal") << " stores and " << layoutNames[options.layout] << " results took "
+			<< processingTime << " seconds (wall clock), " << (bytesMoved / processingTime / 1e9) << " GB/s of array reads and writes.\n";
+		
+		if (kernelRuns[kernelRun] == processRowRangeLookup)
+		{
+			int fallbackRows = 0;
+			for (int i = 0; i < numThreads; i++)
+				fallbackRows += data[i].lookupFallbackRows;
+			
+			cout << fallbackRows << " rows had heights the lookup table could not be used for and were calculated arithmetically.\n";
+		}
+		
+		//every thread has finished, so their collectors can be merged without them changing underneath
+		if (collectingSegments)
+		{
+			double mergeStart = wallTime();
+			mergeSegments(steepestSegments, segmentHits);
+			
+			cout << "Merging every thread's segments took " << (wallTime() - mergeStart) << " seconds";
+			if (options.steeperThan >= 0)
+				cout << " - " << segmentHits.size() << " segments are steeper than " << options.steeperThan << " degrees";
+			cout << ".\n";
+		}
+		
+		printMemoryCounters("processing", runStartCounters, readMemoryCounters());
 	}
 	
-	//calculate elapsed time from start to the point straight after the threads have been created
-	clock_t threadCreationTime = clock() - startTime;
-	time = ((float)threadCreationTime / (float)CLOCKS_PER_SEC);
-	cout << "Up to point where threads are joined, program has taken " << time << " seconds.\n";
+	if (usePool)
+		stopThreadPool(poolThreadIds, poolThreads);
+	
+	delete[] poolThreadIds;
+	
+	//when more than one combination was run, show them side by side with the fastest on this host marked
+	if (numRuns > 1)
+	{
+		int fastestRun = (int)(min_element(runTimes.begin(), runTimes.end()) - runTimes.begin());
+		
+		cout << "Backend | threads | kernel | stores | time (s) | GB/s\n";
+		
+		for (int run = 0; run < numRuns; run++)
+			cout << backendNames[options.backends[run / runsPerBackend]] << " | " << runThreadCounts[run] << " | " << kernelNames[(run % runsPerBackend) / numStoreRuns] << " | "
+				<< (storeRuns[run % numStoreRuns] ? "streaming" : "normal") << " | " << runTimes[run] << " | " << (bytesMoved / runTimes[run] / 1e9)
+				<< (run == fastestRun ? " (fastest)" : "") << "\n";
+		
+		cout << "Fastest on this host: the " << backendNames[options.backends[fastestRun / runsPerBackend]] << " backend with the "
+			<< kernelNames[(fastestRun % runsPerBackend) / numStoreRuns] << " kernel and "
+			<< (storeRuns[fastestRun % numStoreRuns] ? "streaming" : "normal") << " stores.\n";
+	}
 	
-	//set up void pointer to hold thread return value
-	void* threadReturnVal;
-	cout << "Thread run-time data:\n";
+	if (!steepestSegments.empty())
+	{
+		cout << "The " << steepestSegments.size() << " steepest segments:\nRow | column | angle (degrees) | distance\n";
+		
+		for (size_t s = 0; s < steepestSegments.size(); s++)
+			cout << steepestSegments[s].row << " | " << steepestSegments[s].column << " | " << steepestSegments[s].angle << " | " << steepestSegments[s].distance << "\n";
+	}
 	
-	//join each thread back into parent thread, printing out each thread's time to completion
-	for (int i = 0; i < NUM_THREADS; i++)
+	if (!options.hitsPath.empty())
 	{
-		pthread_join(threads[i], &threadReturnVal);
-		cout << "Thread " << i << " completed in " << ((ThreadData*)threadReturnVal)->timeTaken << " seconds.\n";		
+		if (writeSegments(options.hitsPath, segmentHits))
+			cout << segmentHits.size() << " segments steeper than " << options.steeperThan << " degrees written to " << options.hitsPath << ".\n";
+		else
+			cout << "Error! Could not write segments to " << options.hitsPath << "." << endl;
 	}
 	
-	//measure time taken to join the threads back together
-	clock_t postThreadJoinTime = clock() - threadCreationTime;
-	time = ((float)postThreadJoinTime / (float)CLOCKS_PER_SEC);
-	cout << "Joining of threads takes " << time << " seconds.\n";
+	//regions are found in the results of the last run
+	if (options.regionThreshold >= 0)
+		findSteepRegions(results);
+	
+	if (activePyramid != NULL)
+	{
+		double pyramidMegabytes = 0;
+		for (int level = 1; level <= pyramid.levels; level++)
+			pyramidMegabytes += (double)pyramid.rows[level] * pyramid.columns[level] * sizeof(PyramidCell) / (1024 * 1024);
+		
+		const PyramidCell& top = pyramid.cells[pyramid.levels][0];
+		cout << "Built a pyramid of " << pyramid.levels << " levels (" << pyramidMegabytes << "MB) alongside each run - level "
+			<< pyramid.levels << " is " << pyramid.rows[pyramid.levels] << " x " << pyramid.columns[pyramid.levels] << " cells, the first covering angles from "
+			<< top.minAngle << " to " << top.maxAngle << " degrees (mean " << top.meanAngle << ") and a mean distance of " << top.meanDistance << ".\n";
+	}
 	
-	//remove
-	int startRow = 100000;
-	int endRow = 0;
+	if (!options.tracePath.empty())
+	{
+		if (writeTrace(options.tracePath))
+			cout << "Trace written to " << options.tracePath << " (open it in chrome://tracing or https://ui.perfetto.dev).\n";
+		else
+			cout << "Error! Could not write trace to " << options.tracePath << "." << endl;
+	}
 	
-	for (int i = 0; i < ARRAY_HEIGHT; i++)
-	{	
-		for (int j = 0; j < 10; j++)
+	if (!options.saveResultsPath.empty())
+	{
+		setTelemetryPhase("saving", (uint64_t)numRuns * options.arrayHeight);
+		traceStart = traceTimestamp();
+		bool saved;
+		
+		if (options.compress)
+			saved = writeCompressedGrid(options.saveResultsPath, NULL, &results, options.arrayHeight);
+		else
 		{
-			cout << distanceArray[i][j] << " ";
-			if (distanceArray[i][j] > - 0.0001 && distanceArray[i][j] < 0.0001)
-			{
-				if (i < startRow)
-					startRow = i;
-				endRow = i;
-			}
+			float* scratchRow = new float[options.arrayWidth];
+			saved = saveResults(options.saveResultsPath, results, options.arrayHeight, scratchRow, activePyramid);
+			delete[] scratchRow;
 		}
+		
+		traceSpan("save", traceStart, traceTimestamp());
+		
+		if (!saved)
+			cout << "Error! Could not write results to " << options.saveResultsPath << "." << endl;
 	}
 	
-	cout << "rows " << startRow << " to " << endRow << " are all 0s" << endl;
-	//remove
+	//time a consumer which reads the distance and angle of every point together through the result accessors,
+	//so that the layouts can be compared from the reading side as well as the writing side
+	double readStart = wallTime();
+	double checksum = 0;
+	
+	for (int i = 0; i < options.arrayHeight; i++)
+		for (int j = 0; j < options.arrayWidth; j++)
+			checksum += results.distance(i, j) + results.angle(i, j);
+	
+	double readTime = wallTime() - readStart;
+	cout << "Reading back every distance and angle with " << layoutNames[options.layout] << " results took " << readTime << " seconds, "
+		<< ((double)options.arrayHeight * options.arrayWidth * sizeof(float) * 2 / readTime / 1e9) << " GB/s (checksum " << checksum << ").\n";
 	
 	//release memory used for arrays before finishing program
 	delete2DArray<float>(mainArray);
-	delete2DArray<float>(distanceArray);
-	delete2DArray<float>(angleArray);
+	deleteResultGrid(results);
+	deletePyramid(pyramid);
+	activePyramid = NULL;
+	delete[] slopeTable;
+	delete[] data;
+	delete[] threads;
 
 	//calculate and output time taken for entire process to complete
 	clock_t endTime = clock() - startTime;
@@ -180,131 +493,1780 @@ int main ()
 	return 0;
 }
 
-void* processRows(void* data)
+//calculates the distance and angle between point j in a row of heights and the next point along the row
+//Width and Spacing are the row width and point spacing if they are known at compile time, or 0 if the run-time values
+//passed in as width and spacing should be used instead - with constants the compiler can fold spacing * spacing
+//and the wrap-around test, and unroll loops over the row
+//Precision is the type (float or double) used for the square root and arcsine
+template <int Width, int Spacing, typename Precision>
+static inline void calculateSlope(const float* heights, int j, int width, float spacing, float& distance, float& angle)
 {
-	//get start CPU time of thread
-	clock_t t = clock();
+	const int rowWidth = Width != 0 ? Width : width;
+	const Precision horizontalDist = Spacing != 0 ? (Precision)Spacing : (Precision)spacing;
 	
-	//cast pointer back to a pointer to object of type ThreadData
-	ThreadData* threadData = (ThreadData*)data;
+	//set height value to compare with as that of next element in row
+	int nextColumn = j+1;
 	
-	//assign local copies of currentRow and rowsToProcess from the thread parameter data purely for the sake of readability
-	float** mainArray = threadData->mainArray;
-	float** distanceArray = threadData->distanceArray;
-	float** angleArray = threadData->angleArray;
-	int currentRow = threadData->currentRow;
-	int rowsToProcess = threadData->rowsToProcess;
+	//special case:
+	//if we are looking at last element in row, "wrap around" and compare it with first element in that row
+	if (j == rowWidth - 1)
+		nextColumn = 0;
 	
-	//make sure that currentRow is within bounds of array
-	if (currentRow >= ARRAY_HEIGHT)
-	{
-		cout << "Cannot process row " << currentRow << " as it is beyond the bounds of the array!" << endl;
-		pthread_exit(NULL);
-	}
+	//calculate vertical distance between points being compared
+	Precision verticalDist = heights[nextColumn] - heights[j];
 	
-	//calculate distance results and populate corresponding array
-	while (currentRow < ARRAY_HEIGHT && rowsToProcess != 0)
+	//Pythagoras' Theorem to calculate Euclidean distance between the points (hypotenuse of the triangle)
+	Precision hypotenuse = sqrt((verticalDist * verticalDist) + (horizontalDist * horizontalDist));
+	
+	distance = hypotenuse;
+	
+	//calculate angle of slope from one point to the next
+	angle = DEGREES_PER_RADIAN * asin(verticalDist / hypotenuse);
+}
+
+//calculates one row of results into separate distance and angle rows
+template <int Width, int Spacing, typename Precision>
+static void processRowPlanes(const float* heights, float* distances, float* angles, int width, float spacing, bool streamingStores)
+{
+	const int rowWidth = Width != 0 ? Width : width;
+	int j = 0;
+	
+#ifdef __SSE2__
+	//streaming path: calculate four results at a time, then write each group of four straight to memory
+	//every row starts on a cache line boundary (see floatRowStride), so each group of four is 16-byte aligned as required
+	if (streamingStores)
 	{
-		for (int j = 0; j < ARRAY_WIDTH; j++)
+		for (; j + 4 <= rowWidth; j += 4)
 		{
-			//set height value to compare with as that of next element in row
-			int nextColumn = j+1;
-			
-			//special case:
-			//if we are looking at last element in row, "wrap around" and compare it with first element in that row
-			if (j == ARRAY_WIDTH - 1)
-				nextColumn = 0;
+			alignas(16) float distanceGroup[4];
+			alignas(16) float angleGroup[4];
 			
-			//calculate vertical distance between points being compared
-			float verticalDist = mainArray[currentRow][nextColumn] - mainArray[currentRow][j];
+			for (int k = 0; k < 4; k++)
+				calculateSlope<Width, Spacing, Precision>(heights, j + k, width, spacing, distanceGroup[k], angleGroup[k]);
 			
-			//Pythagoras' Theorem to calculate Euclidean distance between the points (hypotenuse of the triangle)
-			float hypotenuse = sqrt((verticalDist * verticalDist) + (HORIZONTAL_POINT_DIST * HORIZONTAL_POINT_DIST));
+			_mm_stream_ps(distances + j, _mm_load_ps(distanceGroup));
+			_mm_stream_ps(angles + j, _mm_load_ps(angleGroup));
+		}
+	}
+#endif
+	
+	//normal path (also finishes off any points left over at the end of the row by the streaming path)
+	for (; j < rowWidth; j++)
+		calculateSlope<Width, Spacing, Precision>(heights, j, width, spacing, distances[j], angles[j]);
+}
+
+//calculates one row of results into a row of {distance, angle} pairs
+template <int Width, int Spacing, typename Precision>
+static void processRowInterleaved(const float* heights, float* pairs, int width, float spacing, bool streamingStores)
+{
+	const int rowWidth = Width != 0 ? Width : width;
+	int j = 0;
+	
+#ifdef __SSE2__
+	//streaming path: two points give four floats, which are written to memory as one 16-byte store
+	if (streamingStores)
+	{
+		for (; j + 2 <= rowWidth; j += 2)
+		{
+			alignas(16) float pairGroup[4];
 			
-			distanceArray[currentRow][j] = hypotenuse;
+			calculateSlope<Width, Spacing, Precision>(heights, j, width, spacing, pairGroup[0], pairGroup[1]);
+			calculateSlope<Width, Spacing, Precision>(heights, j + 1, width, spacing, pairGroup[2], pairGroup[3]);
 			
-			//calculate angle of slope from one point to the next
-			angleArray[currentRow][j] = DEGREES_PER_RADIAN * asin(verticalDist / hypotenuse);
+			_mm_stream_ps(pairs + 2 * j, _mm_load_ps(pairGroup));
 		}
-		rowsToProcess--;
-		currentRow++;
 	}
+#endif
 	
-	//calculate elapsed CPU time since thread began, convert it to seconds and assign it to threadData->timeTaken
-	t = clock() - t;
-	float seconds = (float)t / (float)CLOCKS_PER_SEC;
-	threadData->timeTaken = seconds;
-	
-	//finish thread and return time taken to complete (using ThreadData pointer cast to void pointer)
-	return (void*)threadData;
+	for (; j < rowWidth; j++)
+		calculateSlope<Width, Spacing, Precision>(heights, j, width, spacing, pairs[2 * j], pairs[2 * j + 1]);
 }
 
-float** setupMainArray(void)
+//calculates one row of results into blocks of RESULT_BLOCK_SIZE distances followed by RESULT_BLOCK_SIZE angles
+template <int Width, int Spacing, typename Precision>
+static void processRowBlocked(const float* heights, float* blocks, int width, float spacing, bool streamingStores)
 {
-	//import data for main 2D array from text file
-    ifstream inFile;
-    inFile.open("array.txt");
-
-	//main array to hold the numbers to be operated on by threads
-	float** mainArray = setup2DArrayOnHeap<float>();
+	const int rowWidth = Width != 0 ? Width : width;
 	
-	//temporary storage for numbers as strings before they are converted to floats
-	string** numbersAsStrings = setup2DArrayOnHeap<string>();
-	
-	//imports data from array.txt into numbersAsStrings 2D array
-	for (int i = 0; i < ARRAY_HEIGHT; i++)
+	for (int blockStart = 0; blockStart < rowWidth; blockStart += RESULT_BLOCK_SIZE)
 	{
-		char character = inFile.get();
-		int columnIndex = 0;
+		float* block = blocks + 2 * blockStart;
+		int blockWidth = min(RESULT_BLOCK_SIZE, rowWidth - blockStart);
 		
-		//looks at file char by char
-		//checks for newline and space chars to delimit input
-		while (character != '\n')
-		{	
-			if (character != ' ')
-				numbersAsStrings[i][columnIndex] += character;
-			else
-				columnIndex++;
-				
-			character = inFile.get();
+#ifdef __SSE2__
+		//streaming path: each full block is exactly one cache line, written as four 16-byte stores
+		if (streamingStores && blockWidth == RESULT_BLOCK_SIZE)
+		{
+			alignas(16) float blockValues[2 * RESULT_BLOCK_SIZE];
+			
+			for (int k = 0; k < RESULT_BLOCK_SIZE; k++)
+				calculateSlope<Width, Spacing, Precision>(heights, blockStart + k, width, spacing, blockValues[k], blockValues[RESULT_BLOCK_SIZE + k]);
+			
+			for (int k = 0; k < 2 * RESULT_BLOCK_SIZE; k += 4)
+				_mm_stream_ps(block + k, _mm_load_ps(blockValues + k));
+			
+			continue;
 		}
+#endif
+		
+		for (int k = 0; k < blockWidth; k++)
+			calculateSlope<Width, Spacing, Precision>(heights, blockStart + k, width, spacing, block[k], block[RESULT_BLOCK_SIZE + k]);
 	}
-
-	//convert strings imported from array.txt to floats and store them in main array
-	for (int i = 0; i < ARRAY_HEIGHT; i++)
-		for (int j = 0; j < ARRAY_WIDTH; j++)
-			mainArray[i][j] = stof(numbersAsStrings[i][j]);
-	
-	//deallocate memory used for numbersAsStrings as it is no longer needed
-	delete2DArray<string>(numbersAsStrings);
-	
-	return mainArray;
 }
 
-//set up 2D array on the heap which matches the array dimensions ARRAY_HEIGHT and ARRAY_WIDTH
-template <typename type>
-type** setup2DArrayOnHeap(void)
+//processes the thread's range of rows using the kernel specialised for the given width, spacing and precision
+template <int Width, int Spacing, typename Precision>
+static void processRowRange(ThreadData* threadData)
 {
-	//sets up a double-pointer and points it to a dynamically allocated array of pointers
-	type** newArray = new type*[ARRAY_HEIGHT];
+	//assign local copies of currentRow and rowsToProcess from the thread parameter data purely for the sake of readability
+	float** mainArray = threadData->mainArray;
+	ResultGrid results = threadData->results;
+	bool streamingStores = threadData->streamingStores;
+	int currentRow = threadData->currentRow;
+	int rowsToProcess = threadData->rowsToProcess;
+	int width = options.arrayWidth;
+	float spacing = options.pointSpacing;
+	WorkerProgress* progress = telemetryProgress();
+	SegmentCollector* collector = segmentCollector();
+	Pyramid* pyramid = activePyramid;
 	
-	//sets each element of newArray to point to a dynamically allocated array of variables of chosen type
-	for (int i = 0; i < ARRAY_HEIGHT; i++)
-		newArray[i] = new type[ARRAY_WIDTH];
+	//calculate distance results and populate corresponding array
+	while (currentRow < options.arrayHeight && rowsToProcess != 0)
+	{
+		float* heights = mainArray[currentRow];
+		
+		switch (results.layout)
+		{
+			case LAYOUT_PLANES:
+				processRowPlanes<Width, Spacing, Precision>(heights, results.distanceArray[currentRow], results.angleArray[currentRow], width, spacing, streamingStores);
+				break;
+			case LAYOUT_INTERLEAVED:
+				processRowInterleaved<Width, Spacing, Precision>(heights, results.pairArray[currentRow], width, spacing, streamingStores);
+				break;
+			case LAYOUT_BLOCKED:
+				processRowBlocked<Width, Spacing, Precision>(heights, results.pairArray[currentRow], width, spacing, streamingStores);
+				break;
+		}
+		
+		//the row has only just been written, so it is read back from cache (streaming stores are never used while
+		//segments or the pyramid are being picked out - see useStreamingStores())
+		if (collector != NULL)
+			collectRowSegments(collector, results, currentRow);
+		if (pyramid != NULL)
+			addPyramidRow(pyramid, results, currentRow, streamingStores);
+		
+		if (progress != NULL)
+			addProgress(progress->rowsCompleted, 1);
+		
+		rowsToProcess--;
+		currentRow++;
+	}
 	
-	//return double-pointer to array created
-	return newArray;
+#ifdef __SSE2__
+	//streaming stores are weakly ordered, so make sure they are all visible in memory before the thread finishes
+	//(pthread_join() alone does not guarantee this for non-temporal stores)
+	if (streamingStores)
+		_mm_sfence();
+#endif
 }
 
-template <typename type>
-void delete2DArray(type** array)
+//copies one row of results from separate distance and angle rows into the result grid, in whichever layout it uses
+//used by kernels which work a row at a time into scratch space rather than writing straight into the grid
+static void storeRow(ResultGrid& results, int row, const float* distances, const float* angles, int width, bool streamingStores)
 {
-	//iterate through every row of 2D array and free memory used for each row using array deallocation operator
-	for (int i = 0; i < ARRAY_HEIGHT; i++)
-		delete[] array[i];
-	
-	//free memory used to hold the column data for the 2D array	
-	delete[] array;
+	if (results.layout == LAYOUT_PLANES)
+	{
+		float* distanceRow = results.distanceArray[row];
+		float* angleRow = results.angleArray[row];
+		int j = 0;
+		
+#ifdef __SSE2__
+		if (streamingStores)
+		{
+			for (; j + 4 <= width; j += 4)
+			{
+				_mm_stream_ps(distanceRow + j, _mm_loadu_ps(distances + j));
+				_mm_stream_ps(angleRow + j, _mm_loadu_ps(angles + j));
+			}
+		}
+#endif
+		
+		for (; j < width; j++)
+		{
+			distanceRow[j] = distances[j];
+			angleRow[j] = angles[j];
+		}
+	}
+	else if (results.layout == LAYOUT_INTERLEAVED)
+	{
+		float* pairs = results.pairArray[row];
+		int j = 0;
+		
+#ifdef __SSE2__
+		if (streamingStores)
+		{
+			for (; j + 4 <= width; j += 4)
+			{
+				__m128 distanceGroup = _mm_loadu_ps(distances + j);
+				__m128 angleGroup = _mm_loadu_ps(angles + j);
+				
+				_mm_stream_ps(pairs + 2 * j, _mm_unpacklo_ps(distanceGroup, angleGroup));
+				_mm_stream_ps(pairs + 2 * j + 4, _mm_unpackhi_ps(distanceGroup, angleGroup));
+			}
+		}
+#endif
+		
+		for (; j < width; j++)
+		{
+			pairs[2 * j] = distances[j];
+			pairs[2 * j + 1] = angles[j];
+		}
+	}
+	else
+	{
+		float* blocks = results.pairArray[row];
+		
+		for (int blockStart = 0; blockStart < width; blockStart += RESULT_BLOCK_SIZE)
+		{
+			float* block = blocks + 2 * blockStart;
+			int blockWidth = min(RESULT_BLOCK_SIZE, width - blockStart);
+			
+#ifdef __SSE2__
+			if (streamingStores && blockWidth == RESULT_BLOCK_SIZE)
+			{
+				for (int k = 0; k < RESULT_BLOCK_SIZE; k += 4)
+				{
+					_mm_stream_ps(block + k, _mm_loadu_ps(distances + blockStart + k));
+					_mm_stream_ps(block + RESULT_BLOCK_SIZE + k, _mm_loadu_ps(angles + blockStart + k));
+				}
+				
+				continue;
+			}
+#endif
+			
+			for (int k = 0; k < blockWidth; k++)
+			{
+				block[k] = distances[blockStart + k];
+				block[RESULT_BLOCK_SIZE + k] = angles[blockStart + k];
+			}
+		}
+	}
+}
+
+//range of table entries filled in by one thread while the table is being built
+struct TableBuildData
+{
+	int firstEntry;
+	int lastEntry;
+};
+
+void* buildSlopeTableRange(void* data)
+{
+	TableBuildData* buildData = (TableBuildData*)data;
+	double horizontalDist = options.pointSpacing;
+	
+	for (int i = buildData->firstEntry; i < buildData->lastEntry; i++)
+	{
+		//work in double precision from the exact difference, so each entry is the correctly rounded result for that difference
+		double verticalDist = (double)(i - LOOKUP_MAX_DIFF) / LOOKUP_SCALE;
+		double hypotenuse = sqrt((verticalDist * verticalDist) + (horizontalDist * horizontalDist));
+		
+		slopeTable[i].distance = (float)hypotenuse;
+		slopeTable[i].angle = (float)(DEGREES_PER_RADIAN * asin(verticalDist / hypotenuse));
+	}
+	
+	return NULL;
+}
+
+void buildSlopeTable(void)
+{
+	int numEntries = 2 * LOOKUP_MAX_DIFF + 1;
+	slopeTable = new SlopeEntry[numEntries];
+	
+	//split the table between one thread per available CPU
+	int numThreads = availableCpuCount();
+	
+	pthread_t* threads = new pthread_t[numThreads];
+	TableBuildData* buildData = new TableBuildData[numThreads];
+	
+	double start = wallTime();
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		buildData[i].firstEntry = (int)((long long)numEntries * i / numThreads);
+		buildData[i].lastEntry = (int)((long long)numEntries * (i + 1) / numThreads);
+		pthread_create(&threads[i], NULL, buildSlopeTableRange, (void*)&buildData[i]);
+	}
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	double buildTime = wallTime() - start;
+	
+	long cacheSize = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	double tableMegabytes = (double)numEntries * sizeof(SlopeEntry) / (1024 * 1024);
+	
+	cout << "Building the " << tableMegabytes << "MB lookup table with " << numThreads << " threads took " << buildTime << " seconds";
+	if (cacheSize > 0)
+		cout << " (last level cache is " << (cacheSize / (1024 * 1024)) << "MB)";
+	cout << ".\n";
+	
+	delete[] threads;
+	delete[] buildData;
+}
+
+//converts a row of heights to integers scaled by LOOKUP_SCALE
+//returns false if any height is outside the table's range or is not exactly the float nearest to a whole number of thousandths
+static bool scaleRow(const float* heights, int* scaledHeights, int width)
+{
+	bool onGrid = true;
+	
+	for (int j = 0; j < width; j++)
+	{
+		float height = heights[j];
+		
+		if (!(height >= 0 && height < LOOKUP_HEIGHT_LIMIT))
+			return false;
+		
+		int scaled = (int)lrint((double)height * LOOKUP_SCALE);
+		scaledHeights[j] = scaled;
+		
+		//the loader converts values to floats in the same way, so a height on the grid comes back exactly
+		onGrid &= ((float)((double)scaled / LOOKUP_SCALE) == height);
+	}
+	
+	return onGrid;
+}
+
+void processRowRangeLookup(ThreadData* threadData)
+{
+	float** mainArray = threadData->mainArray;
+	ResultGrid results = threadData->results;
+	bool streamingStores = threadData->streamingStores;
+	int currentRow = threadData->currentRow;
+	int rowsToProcess = threadData->rowsToProcess;
+	int width = options.arrayWidth;
+	float spacing = options.pointSpacing;
+	
+	//scratch space for one row of scaled heights and results
+	int* scaledHeights = new int[width];
+	float* distances = new float[width];
+	float* angles = new float[width];
+	
+	const SlopeEntry* table = slopeTable + LOOKUP_MAX_DIFF;
+	WorkerProgress* progress = telemetryProgress();
+	SegmentCollector* collector = segmentCollector();
+	Pyramid* pyramid = activePyramid;
+	
+	while (currentRow < options.arrayHeight && rowsToProcess != 0)
+	{
+		float* heights = mainArray[currentRow];
+		
+		if (scaleRow(heights, scaledHeights, width))
+		{
+			for (int j = 0; j < width - 1; j++)
+			{
+				SlopeEntry entry = table[scaledHeights[j + 1] - scaledHeights[j]];
+				distances[j] = entry.distance;
+				angles[j] = entry.angle;
+			}
+			
+			//last point in the row wraps around to the first
+			SlopeEntry entry = table[scaledHeights[0] - scaledHeights[width - 1]];
+			distances[width - 1] = entry.distance;
+			angles[width - 1] = entry.angle;
+		}
+		else
+		{
+			//fall back to arithmetic for rows the table cannot be used for
+			for (int j = 0; j < width; j++)
+				calculateSlope<0, 0, float>(heights, j, width, spacing, distances[j], angles[j]);
+			
+			threadData->lookupFallbackRows++;
+		}
+		
+		storeRow(results, currentRow, distances, angles, width, streamingStores);
+		
+		if (collector != NULL)
+			collectRowSegments(collector, currentRow, distances, angles);
+		if (pyramid != NULL)
+			addPyramidRow(pyramid, results, currentRow, streamingStores);
+		
+		if (progress != NULL)
+			addProgress(progress->rowsCompleted, 1);
+		
+		rowsToProcess--;
+		currentRow++;
+	}
+	
+#ifdef __SSE2__
+	if (streamingStores)
+		_mm_sfence();
+#endif
+	
+	delete[] scaledHeights;
+	delete[] distances;
+	delete[] angles;
+}
+
+//one entry in the table of specialised kernels - a width or spacing of 0 matches any value
+struct KernelEntry
+{
+	int width;
+	int spacing;
+	bool doublePrecision;
+	RowRangeKernel kernel;
+};
+
+//specialised kernels for common widths and spacings, followed by generic kernels which work for any width and spacing
+//selectKernel() uses the first entry that matches, so the generic kernels must stay at the end of the table
+#define SPECIALISED_KERNELS(width, spacing) \
+	{ width, spacing, false, processRowRange<width, spacing, float> }, \
+	{ width, spacing, true, processRowRange<width, spacing, double> }
+
+static const KernelEntry kernelTable[] =
+{
+	SPECIALISED_KERNELS(1000, 50),
+	SPECIALISED_KERNELS(1000, 10),
+	SPECIALISED_KERNELS(1000, 25),
+	SPECIALISED_KERNELS(1024, 50),
+	SPECIALISED_KERNELS(1024, 10),
+	SPECIALISED_KERNELS(1024, 25),
+	SPECIALISED_KERNELS(2048, 50),
+	SPECIALISED_KERNELS(2048, 10),
+	SPECIALISED_KERNELS(2048, 25),
+	SPECIALISED_KERNELS(0, 0)
+};
+
+RowRangeKernel selectKernel(int width, float spacing, bool doublePrecision, bool& specialised)
+{
+	int numKernels = sizeof(kernelTable) / sizeof(kernelTable[0]);
+	
+	for (int i = 0; i < numKernels; i++)
+	{
+		const KernelEntry& entry = kernelTable[i];
+		
+		if (entry.doublePrecision != doublePrecision)
+			continue;
+		
+		//the generic entry matches anything, specialised entries only match an exact width and a whole-number spacing
+		if (entry.width == 0 || (entry.width == width && (float)entry.spacing == spacing))
+		{
+			specialised = entry.width != 0;
+			return entry.kernel;
+		}
+	}
+	
+	//never reached, as the generic kernels match everything
+	specialised = false;
+	return processRowRange<0, 0, float>;
+}
+
+//processes the rows given to a thread by partitionRows() - either its own fixed range, or chunks taken from the shared counter
+static void processAssignedRows(ThreadData* threadData)
+{
+	if (options.chunkRows > 0)
+	{
+		//dynamic scheduling: keep taking the next chunk of rows from the shared counter until every row has been handed out
+		//threads that finish their chunks early take more, so a slow thread holds up the others by at most one chunk
+		while (true)
+		{
+			uint64_t stealStart = traceTimestamp();
+			int chunkStart = nextChunkRow.fetch_add(options.chunkRows, memory_order_relaxed);
+			uint64_t chunkTraceStart = traceTimestamp();
+			traceSpan("steal", stealStart, chunkTraceStart);
+			
+			if (chunkStart >= chunkEndRow)
+				break;
+			
+			threadData->currentRow = chunkStart;
+			threadData->rowsToProcess = min(options.chunkRows, chunkEndRow - chunkStart);
+			threadData->kernel(threadData);
+			
+			traceSpan("rows", chunkTraceStart, traceTimestamp(), chunkStart, threadData->rowsToProcess);
+		}
+	}
+	else
+	{
+		//make sure that currentRow is within bounds of array
+		if (threadData->currentRow >= options.arrayHeight)
+		{
+			cout << "Cannot process row " << threadData->currentRow << " as it is beyond the bounds of the array!" << endl;
+			pthread_exit(NULL);
+		}
+		
+		//run the kernel chosen for this run's width, spacing and precision in main()
+		uint64_t chunkTraceStart = traceTimestamp();
+		threadData->kernel(threadData);
+		traceSpan("rows", chunkTraceStart, traceTimestamp(), threadData->currentRow, threadData->rowsToProcess);
+	}
+}
+
+void* processRows(void* data)
+{
+	//get start CPU time of thread
+	clock_t t = clock();
+	
+	//cast pointer back to a pointer to object of type ThreadData
+	ThreadData* threadData = (ThreadData*)data;
+	threadData->traceBuffer = traceThread("worker " + to_string(threadData->threadIndex));
+	
+	processAssignedRows(threadData);
+	
+	threadData->finishTicks = traceTimestamp();
+	
+	//calculate elapsed CPU time since thread began, convert it to seconds and assign it to threadData->timeTaken
+	t = clock() - t;
+	float seconds = (float)t / (float)CLOCKS_PER_SEC;
+	threadData->timeTaken = seconds;
+	
+	//finish thread and return time taken to complete (using ThreadData pointer cast to void pointer)
+	return (void*)threadData;
+}
+
+void partitionRows(ThreadData* data, int numThreads, int firstRow, int numRows)
+{
+	//split up rows equally between threads and store results in rowsToProcess
+	int rowsToProcess = numRows / numThreads;
+	
+	//store number of rows that could not be split up equally between threads
+	//each thread will be allocated one of these rows in addition to its normal workload (until no remainder rows are left)
+	int remainderRows = numRows % numThreads;
+	
+	//keeps track of current row in array so this data can be passed to threads
+	int currentRow = firstRow;
+	
+	//when rows are handed out in chunks instead, threads take them from this range
+	nextChunkRow = firstRow;
+	chunkEndRow = firstRow + numRows;
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		data[i].currentRow = currentRow;
+		
+		//give one of the extra rows to each thread in turn until all rows have been assigned to a thread
+		if (remainderRows != 0)
+		{
+			data[i].rowsToProcess = rowsToProcess + 1;
+			remainderRows--;
+			currentRow += rowsToProcess + 1;
+		}
+		//once extra rows have been dealt with, use else block to allocate each thread the normal number of rows to process
+		else
+		{
+			data[i].rowsToProcess = rowsToProcess;
+			currentRow += rowsToProcess;
+		}
+	}
+}
+
+//range of a grid's rows faulted in by one thread
+struct PrefaultData
+{
+	char* start;
+	size_t bytes;
+	int firstRow;
+	int numRows;
+	int threadIndex;
+};
+
+void* prefaultRows(void* data)
+{
+	PrefaultData* prefaultData = (PrefaultData*)data;
+	
+	traceThread("prefault " + to_string(prefaultData->threadIndex));
+	uint64_t traceStart = traceTimestamp();
+	
+	if (prefaultData->bytes == 0)
+		return NULL;
+	
+	//write to one value in every page so the kernel has to back each page with physical memory now
+	//writing (rather than reading) is needed, as reading a fresh anonymous page only maps the shared zero page
+	for (size_t offset = 0; offset < prefaultData->bytes; offset += SMALL_PAGE_SIZE)
+		prefaultData->start[offset] = 0;
+	
+	prefaultData->start[prefaultData->bytes - 1] = 0;
+	
+	traceSpan("prefault", traceStart, traceTimestamp(), prefaultData->firstRow, prefaultData->numRows);
+	
+	return NULL;
+}
+
+//faults in every row of a newly allocated grid, splitting the rows evenly between threads as partitionRows() does
+//at most one thread per usable CPU is used - with the default thread count, creating a thread for every few rows of
+//each grid would cost more than the page faults it saves
+static void prefaultGrid(char* block, size_t rowStride)
+{
+	double start = wallTime();
+	int numThreads = max(1, min(min(options.numThreads, availableCpuCount()), options.arrayHeight));
+	int rowsPerThread = options.arrayHeight / numThreads;
+	int remainderRows = options.arrayHeight % numThreads;
+	
+	PrefaultData* prefaultData = new PrefaultData[numThreads];
+	pthread_t* threads = new pthread_t[numThreads];
+	int firstRow = 0;
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		prefaultData[i].firstRow = firstRow;
+		prefaultData[i].numRows = rowsPerThread + (i < remainderRows ? 1 : 0);
+		prefaultData[i].start = block + (size_t)firstRow * rowStride * sizeof(float);
+		prefaultData[i].bytes = (size_t)prefaultData[i].numRows * rowStride * sizeof(float);
+		prefaultData[i].threadIndex = i;
+		firstRow += prefaultData[i].numRows;
+		
+		pthread_create(&threads[i], NULL, prefaultRows, (void*)&prefaultData[i]);
+	}
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	delete[] prefaultData;
+	delete[] threads;
+	
+	prefaultTime += wallTime() - start;
+}
+
+bool rowsReadBack(void)
+{
+	return options.topSegments > 0 || options.steeperThan >= 0 || options.pyramidLevels > 0;
+}
+
+bool useStreamingStores(StoreMode mode)
+{
+#ifndef __SSE2__
+	//non-temporal stores are only implemented using SSE2 intrinsics, so always fall back to normal stores without them
+	return false;
+#else
+	//streaming stores would send every row to memory just before it is read back again
+	if (mode == STORES_NORMAL || rowsReadBack())
+		return false;
+	if (mode == STORES_STREAMING)
+		return true;
+	
+	//automatic choice: stream once the two result arrays together are bigger than the last level cache,
+	//since at that size they would be evicted before anything could read them again anyway
+	long cacheSize = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (cacheSize <= 0)
+		cacheSize = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (cacheSize <= 0)
+		cacheSize = 8 * 1024 * 1024;
+	
+	double resultBytes = (double)options.arrayHeight * options.arrayWidth * sizeof(float) * 2;
+	return resultBytes > cacheSize;
+#endif
+}
+
+double wallTime(void)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+float** setupMainArrayFromStrings(void)
+{
+	//import data for main 2D array from text file
+    ifstream inFile;
+    inFile.open("array.txt");
+
+	//main array to hold the numbers to be operated on by threads
+	float** mainArray = setup2DArrayOnHeap<float>();
+	
+	//temporary storage for numbers as strings before they are converted to floats
+	string** numbersAsStrings = setup2DArrayOnHeap<string>();
+	
+	//imports data from array.txt into numbersAsStrings 2D array
+	for (int i = 0; i < options.arrayHeight; i++)
+	{
+		char character = inFile.get();
+		int columnIndex = 0;
+		
+		//looks at file char by char
+		//checks for newline and space chars to delimit input
+		while (character != '\n')
+		{	
+			if (character != ' ')
+				numbersAsStrings[i][columnIndex] += character;
+			else
+				columnIndex++;
+				
+			character = inFile.get();
+		}
+	}
+
+	//convert strings imported from array.txt to floats and store them in main array
+	for (int i = 0; i < options.arrayHeight; i++)
+		for (int j = 0; j < options.arrayWidth; j++)
+			mainArray[i][j] = stof(numbersAsStrings[i][j]);
+	
+	//deallocate memory used for numbersAsStrings as it is no longer needed
+	delete2DArray<string>(numbersAsStrings);
+	
+	return mainArray;
+}
+
+//set up 2D array on the heap which matches the array dimensions chosen for this run
+template <typename type>
+type** setup2DArrayOnHeap(void)
+{
+	//sets up a double-pointer and points it to a dynamically allocated array of pointers
+	type** newArray = new type*[options.arrayHeight];
+	
+	//sets each element of newArray to point to a dynamically allocated array of variables of chosen type
+	for (int i = 0; i < options.arrayHeight; i++)
+		newArray[i] = new type[options.arrayWidth];
+	
+	//return double-pointer to array created
+	return newArray;
+}
+
+template <typename type>
+void delete2DArray(type** array)
+{
+	//iterate through every row of 2D array and free memory used for each row using array deallocation operator
+	for (int i = 0; i < options.arrayHeight; i++)
+		delete[] array[i];
+	
+	//free memory used to hold the column data for the 2D array	
+	delete[] array;
+}
+
+//set up a float 2D array as a single contiguous, huge page aligned block with one row pointer per row of the array
+//each row is rowStride floats apart, and rowStride is always a whole number of cache lines, so every row starts on a cache line boundary
+//keeping the rows together lets the block be backed by 2MB pages, which cuts the number of page faults and TLB misses
+//when the grids are first written and then streamed through by the threads
+float** setupFloatGrid(size_t rowStride)
+{
+	//size in bytes of the mapping used for the grid (always a whole number of huge pages)
+	size_t bytes = (size_t)options.arrayHeight * rowStride * sizeof(float);
+	size_t mappingSize = ((bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+	
+	char* block = NULL;
+	
+	//try the hugetlbfs pool first if it was requested - this fails if no huge pages have been reserved by the administrator
+	if (options.hugePages == HUGE_PAGES_HUGETLB)
+	{
+		void* mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		
+		if (mapping != MAP_FAILED)
+			block = (char*)mapping;
+		else
+			cout << "Warning! Could not allocate from the hugetlbfs pool (" << strerror(errno) << "), using transparent huge pages instead." << endl;
+	}
+	
+	if (block == NULL)
+	{
+		//over-allocate by one huge page so the start of the grid can be aligned to a huge page boundary
+		//then give the unused head and tail back to the kernel so that the grid is exactly mappingSize bytes long
+		size_t paddedSize = mappingSize + HUGE_PAGE_SIZE;
+		void* mapping = mmap(NULL, paddedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		
+		if (mapping == MAP_FAILED)
+		{
+			cout << "Error! Could not allocate " << mappingSize << " bytes for a 2D array." << endl;
+			exit(1);
+		}
+		
+		char* start = (char*)mapping;
+		block = (char*)(((uintptr_t)start + HUGE_PAGE_SIZE - 1) & ~((uintptr_t)HUGE_PAGE_SIZE - 1));
+		
+		size_t headSize = block - start;
+		size_t tailSize = paddedSize - headSize - mappingSize;
+		
+		if (headSize != 0)
+			munmap(start, headSize);
+		if (tailSize != 0)
+			munmap(block + mappingSize, tailSize);
+		
+		//ask for transparent huge pages - the kernel only uses them for madvise()d memory in its default configuration
+		if (options.hugePages != HUGE_PAGES_NONE)
+			madvise(block, mappingSize, MADV_HUGEPAGE);
+	}
+	
+	//row pointers are kept in a normal array so that the grid can still be indexed as grid[row][column]
+	//two extra slots in front of the first row pointer hold the start and end of the block, so it can be found again
+	//when the grid is deleted even if options.arrayHeight has changed since (as it does between roofline working sets)
+	float** slots = new float*[options.arrayHeight + 2];
+	slots[0] = (float*)block;
+	slots[1] = (float*)(block + mappingSize);
+	
+	float** newArray = slots + 2;
+	
+	for (int i = 0; i < options.arrayHeight; i++)
+		newArray[i] = (float*)block + (size_t)i * rowStride;
+	
+	if (options.prefault)
+		prefaultGrid(block, rowStride);
+	
+	return newArray;
+}
+
+template <>
+float** setup2DArrayOnHeap<float>(void)
+{
+	return setupFloatGrid(floatRowStride);
+}
+
+template <>
+void delete2DArray<float>(float** array)
+{
+	//return the whole block in one go, then free the row pointers (which start two slots before the first row)
+	float** slots = array - 2;
+	char* blockStart = (char*)slots[0];
+	char* blockEnd = (char*)slots[1];
+	
+	munmap(blockStart, blockEnd - blockStart);
+	delete[] slots;
+}
+
+ResultGrid setupResultGrid(ResultLayout layout)
+{
+	ResultGrid results;
+	results.layout = layout;
+	results.distanceArray = NULL;
+	results.angleArray = NULL;
+	results.pairArray = NULL;
+	
+	if (layout == LAYOUT_PLANES)
+	{
+		results.distanceArray = setup2DArrayOnHeap<float>();
+		results.angleArray = setup2DArrayOnHeap<float>();
+	}
+	else
+		results.pairArray = setupFloatGrid(resultRowStride(layout));
+	
+	return results;
+}
+
+void deleteResultGrid(ResultGrid& results)
+{
+	if (results.layout == LAYOUT_PLANES)
+	{
+		delete2DArray<float>(results.distanceArray);
+		delete2DArray<float>(results.angleArray);
+	}
+	else
+		delete2DArray<float>(results.pairArray);
+}
+
+size_t resultRowStride(ResultLayout layout)
+{
+	//interleaved rows hold two floats per point, and a blocked row holds whole blocks of RESULT_BLOCK_SIZE pairs
+	//(2 * floatRowStride covers both, as floatRowStride is a multiple of RESULT_BLOCK_SIZE)
+	if (layout == LAYOUT_PLANES)
+		return floatRowStride;
+	
+	return 2 * floatRowStride;
+}
+
+//file descriptors of the perf_event counters for dTLB load and store misses (-1 if a counter could not be opened)
+static int dtlbLoadMissCounter = -1;
+static int dtlbStoreMissCounter = -1;
+
+//file descriptor of the perf_event counter for last level cache misses (-1 if it could not be opened)
+static int cacheMissCounter = -1;
+
+static int openCounter(int type, long long config)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	
+	//count events in threads created after this point too (the main thread opens the counter before creating any threads)
+	attr.inherit = 1;
+	
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void startMemoryCounters(void)
+{
+	long long dtlbMiss = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	
+	dtlbLoadMissCounter = openCounter(PERF_TYPE_HW_CACHE, dtlbMiss | (PERF_COUNT_HW_CACHE_OP_READ << 8));
+	dtlbStoreMissCounter = openCounter(PERF_TYPE_HW_CACHE, dtlbMiss | (PERF_COUNT_HW_CACHE_OP_WRITE << 8));
+	cacheMissCounter = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	
+	if (dtlbLoadMissCounter == -1 && dtlbStoreMissCounter == -1 && cacheMissCounter == -1)
+		cout << "Note: dTLB and cache miss counters are unavailable (check /proc/sys/kernel/perf_event_paranoid), only page faults will be reported." << endl;
+}
+
+static long long readCounter(int fd)
+{
+	long long value = -1;
+	
+	if (fd == -1 || read(fd, &value, sizeof(value)) != sizeof(value))
+		return -1;
+	
+	return value;
+}
+
+MemoryCounters readMemoryCounters(void)
+{
+	MemoryCounters counters;
+	
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	counters.minorFaults = usage.ru_minflt;
+	counters.majorFaults = usage.ru_majflt;
+	counters.dtlbLoadMisses = readCounter(dtlbLoadMissCounter);
+	counters.dtlbStoreMisses = readCounter(dtlbStoreMissCounter);
+	counters.cacheMisses = readCounter(cacheMissCounter);
+	
+	return counters;
+}
+
+void printMemoryCounters(const char* phase, MemoryCounters before, MemoryCounters after)
+{
+	cout << "During " << phase << ": " << (after.minorFaults - before.minorFaults) << " minor faults, "
+		<< (after.majorFaults - before.majorFaults) << " major faults";
+	
+	if (after.dtlbLoadMisses != -1)
+		cout << ", " << (after.dtlbLoadMisses - before.dtlbLoadMisses) << " dTLB load misses";
+	if (after.dtlbStoreMisses != -1)
+		cout << ", " << (after.dtlbStoreMisses - before.dtlbStoreMisses) << " dTLB store misses";
+	if (after.cacheMisses != -1)
+		cout << ", " << (after.cacheMisses - before.cacheMisses) << " cache misses";
+	
+	cout << ".\n";
+}
+
+bool parseOptions(int argc, char* argv[])
+{
+	//default behaviour is the same as before these options existed
+	options.hugePages = HUGE_PAGES_NONE;
+	options.prefault = false;
+	options.stores = STORES_AUTO;
+	options.layout = LAYOUT_PLANES;
+	options.arrayWidth = ARRAY_WIDTH;
+	options.arrayHeight = ARRAY_HEIGHT;
+	options.pointSpacing = HORIZONTAL_POINT_DIST;
+	options.doublePrecision = false;
+	options.parseBenchmark = false;
+	options.kernelMode = KERNEL_MATH;
+	options.backends.assign(1, BACKEND_PTHREADS);
+	options.numThreads = NUM_THREADS;
+	options.chunkRows = 0;
+	options.calibrate = false;
+	options.roofline = false;
+	options.useProfile = true;
+	options.tracePath = "";
+	options.topSegments = 0;
+	options.steeperThan = -1;
+	options.hitsPath = "";
+	options.regionThreshold = -1;
+	options.regionsPath = "";
+	options.pyramidLevels = 0;
+	options.previewPath = "";
+	options.previewLevel = 0;
+	options.streamPath = "";
+	options.streamBatchRows = 1;
+	options.streamOutputPath = "";
+	options.telemetryInterval = 0;
+	options.telemetryPath = "";
+	options.convertPath = "";
+	options.outOfCorePath = "";
+	options.resultsPath = "";
+	options.memoryBudgets.clear();
+	options.batchPath = "";
+	options.shardedPath = "";
+	options.numProcesses = 4;
+	options.shardRows = 0;
+	options.shardSharedMemory = true;
+	options.shardWorker = "";
+	options.inputPath = "";
+	options.saveResultsPath = "";
+	options.compress = false;
+	options.codec = CODEC_LZ4;
+	
+	//the profile is kept in the home directory, with one file per host so that a shared home directory works
+	char hostname[256] = "unknown";
+	gethostname(hostname, sizeof(hostname) - 1);
+	const char* home = getenv("HOME");
+	options.profilePath = string(home != NULL ? home : ".") + "/.cw1Part3-" + hostname + ".profile";
+	
+	//the profile has to be found and loaded before any other options are applied,
+	//so that anything given on the command line overrides the profile's settings
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		
+		if (arg.compare(0, 10, "--profile=") == 0)
+			options.profilePath = arg.substr(10);
+		else if (arg == "--no-profile" || arg == "--calibrate")
+			options.useProfile = false;
+	}
+	
+	if (options.useProfile && loadProfile())
+		cout << "Loaded settings for this host from " << options.profilePath << ".\n";
+	
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		
+		if (!applyOption(arg))
+		{
+			cout << "Error! Unrecognised option \"" << arg << "\"." << endl;
+			cout << "Usage: " << argv[0] << " [--hugepages=none|thp|hugetlb] [--prefault] [--stores=auto|normal|streaming|both] [--layout=planes|interleaved|blocked]"
+				<< " [--width=N] [--height=N] [--spacing=X] [--precision=single|double] [--parse-benchmark]"
+				<< " [--kernel=math|lookup|both] [--backend=NAME[,NAME...]|all] [--threads=N] [--chunk=N] [--calibrate] [--roofline] [--profile=FILE] [--no-profile]"
+				<< " [--trace=FILE] [--top=K] [--steeper-than=DEGREES] [--hits=FILE] [--regions=DEGREES] [--regions-file=FILE] [--pyramid[=LEVELS]] [--preview=FILE[,LEVEL]] [--stream[=-|SOCKET]] [--stream-batch=N] [--stream-output=FILE] [--telemetry[=SECONDS]] [--telemetry-file=FILE] [--convert=FILE] [--out-of-core=FILE] [--results=FILE] [--memory-budget=MB[,MB...]] [--batch=DIR|LIST]"
+				<< " [--sharded=FILE] [--processes=N] [--shard-rows=N] [--shard-store=shm|file]"
+				<< " [--input=FILE] [--save-results=FILE] [--compress[=lz4|zstd]]" << endl;
+			return false;
+		}
+	}
+	
+	if (options.topSegments < 0 || options.steeperThan > 90)
+	{
+		cout << "Error! Number of steepest segments cannot be negative and no segment is steeper than 90 degrees." << endl;
+		return false;
+	}
+	
+	if (!options.hitsPath.empty() && options.steeperThan < 0)
+	{
+		cout << "Error! --hits needs --steeper-than to say which segments to list." << endl;
+		return false;
+	}
+	
+	if (options.regionThreshold > 90 || (!options.regionsPath.empty() && options.regionThreshold < 0))
+	{
+		cout << "Error! No segment is steeper than 90 degrees, and --regions-file needs --regions to say which segments to group." << endl;
+		return false;
+	}
+	
+	if (options.streamBatchRows < 1 || options.streamBatchRows > STREAM_RING_ROWS)
+	{
+		cout << "Error! Stream batches must be between 1 and " << STREAM_RING_ROWS << " rows." << endl;
+		return false;
+	}
+	
+	//a stream only ever holds a few rows at once, so there is no whole grid to pick segments, regions or a pyramid out of
+	if (!options.streamPath.empty() && (options.topSegments > 0 || options.steeperThan >= 0 || options.regionThreshold >= 0 || options.pyramidLevels > 0))
+	{
+		cout << "Error! --top, --steeper-than, --regions and --pyramid need a whole grid, so cannot be used with --stream." << endl;
+		return false;
+	}
+	
+	//out-of-core, batch and sharded runs never merge the collectors, so they would pay for collecting segments and list none
+	if ((!options.outOfCorePath.empty() || !options.batchPath.empty() || !options.shardedPath.empty()) && (options.topSegments > 0 || options.steeperThan >= 0))
+	{
+		cout << "Error! --top, --steeper-than and --hits are only reported for a whole grid, so cannot be used with --out-of-core, --batch or --sharded." << endl;
+		return false;
+	}
+	
+	//steep regions are only labelled once a whole grid has been processed in memory, which these modes never do
+	if ((!options.outOfCorePath.empty() || !options.batchPath.empty() || !options.shardedPath.empty()) && options.regionThreshold >= 0)
+	{
+		cout << "Error! --regions needs a whole grid, so cannot be used with --out-of-core, --batch or --sharded." << endl;
+		return false;
+	}
+	
+	//a stream's rows are processed once, as they arrive, so there is no second run to try the other kernel on
+	if (!options.streamPath.empty() && options.kernelMode == KERNEL_BOTH)
+	{
+		cout << "Error! --kernel=both compares two runs over the same grid, so cannot be used with --stream." << endl;
+		return false;
+	}
+	
+	if (options.pyramidLevels < 0 || options.previewLevel < 0)
+	{
+		cout << "Error! Number of pyramid levels cannot be negative." << endl;
+		return false;
+	}
+	
+	if (options.pyramidLevels > 0 && options.compress)
+	{
+		cout << "Error! The pyramid is only stored in uncompressed result files, so --pyramid cannot be used with --compress." << endl;
+		return false;
+	}
+	
+	if (options.telemetryInterval < 0)
+	{
+		cout << "Error! Telemetry interval cannot be negative." << endl;
+		return false;
+	}
+	
+	if (options.numThreads < 1 || options.chunkRows < 0)
+	{
+		cout << "Error! Number of threads must be at least 1 and chunk size cannot be negative." << endl;
+		return false;
+	}
+	
+#ifndef USE_ZSTD
+	if (options.compress && options.codec == CODEC_ZSTD)
+	{
+		cout << "Error! This build does not include zstd (build with -DUSE_ZSTD -lzstd), use --compress=lz4 instead." << endl;
+		return false;
+	}
+#endif
+	
+	for (size_t i = 0; i < options.backends.size(); i++)
+	{
+		if (!backendAvailable(options.backends[i]))
+		{
+			cout << "Error! This build does not include the " << backendNames[options.backends[i]] << " backend (build with "
+				<< (options.backends[i] == BACKEND_PAR ? "-DUSE_STD_EXECUTION -ltbb" : "-fopenmp") << ")." << endl;
+			return false;
+		}
+	}
+	
+	if (options.numProcesses < 1 || options.shardRows < 0)
+	{
+		cout << "Error! Number of processes must be at least 1 and shard size cannot be negative." << endl;
+		return false;
+	}
+	
+	if (options.arrayWidth < 2 || options.arrayHeight < 1 || !(options.pointSpacing > 0))
+	{
+		cout << "Error! Array width must be at least 2, height at least 1 and spacing greater than 0." << endl;
+		return false;
+	}
+	
+	for (size_t i = 0; i < options.memoryBudgets.size(); i++)
+	{
+		if (options.memoryBudgets[i] < 1)
+		{
+			cout << "Error! Memory budgets must be at least 1MB." << endl;
+			return false;
+		}
+	}
+	
+	if (options.memoryBudgets.empty())
+		options.memoryBudgets.push_back(DEFAULT_MEMORY_BUDGET_MB);
+	
+	if (options.resultsPath.empty())
+		options.resultsPath = options.outOfCorePath + ".results";
+	
+	//round each row of a float grid up to a whole number of cache lines
+	size_t floatsPerCacheLine = CACHE_LINE_SIZE / sizeof(float);
+	floatRowStride = ((options.arrayWidth + floatsPerCacheLine - 1) / floatsPerCacheLine) * floatsPerCacheLine;
+	
+	return true;
+}
+
+bool applyOption(const string& arg)
+{
+	if (arg == "--hugepages=none")
+		options.hugePages = HUGE_PAGES_NONE;
+	else if (arg == "--hugepages=thp" || arg == "--hugepages")
+		options.hugePages = HUGE_PAGES_THP;
+	else if (arg == "--hugepages=hugetlb")
+		options.hugePages = HUGE_PAGES_HUGETLB;
+	else if (arg == "--prefault")
+		options.prefault = true;
+	else if (arg == "--stores=auto")
+		options.stores = STORES_AUTO;
+	else if (arg == "--stores=normal")
+		options.stores = STORES_NORMAL;
+	else if (arg == "--stores=streaming")
+		options.stores = STORES_STREAMING;
+	else if (arg == "--stores=both")
+		options.stores = STORES_BOTH;
+	else if (arg == "--layout=planes")
+		options.layout = LAYOUT_PLANES;
+	else if (arg == "--layout=interleaved")
+		options.layout = LAYOUT_INTERLEAVED;
+	else if (arg == "--layout=blocked")
+		options.layout = LAYOUT_BLOCKED;
+	else if (arg.compare(0, 8, "--width=") == 0)
+		options.arrayWidth = atoi(arg.c_str() + 8);
+	else if (arg.compare(0, 9, "--height=") == 0)
+		options.arrayHeight = atoi(arg.c_str() + 9);
+	else if (arg.compare(0, 10, "--spacing=") == 0)
+		options.pointSpacing = atof(arg.c_str() + 10);
+	else if (arg == "--precision=single")
+		options.doublePrecision = false;
+	else if (arg == "--precision=double")
+		options.doublePrecision = true;
+	else if (arg == "--parse-benchmark")
+		options.parseBenchmark = true;
+	else if (arg == "--kernel=math")
+		options.kernelMode = KERNEL_MATH;
+	else if (arg == "--kernel=lookup")
+		options.kernelMode = KERNEL_LOOKUP;
+	else if (arg == "--kernel=both")
+		options.kernelMode = KERNEL_BOTH;
+	else if (arg == "--backend=all")
+	{
+		//every backend this build includes
+		options.backends.clear();
+		
+		for (int b = 0; b < NUM_BACKENDS; b++)
+			if (backendAvailable((Backend)b))
+				options.backends.push_back((Backend)b);
+	}
+	else if (arg.compare(0, 10, "--backend=") == 0)
+	{
+		//comma-separated list of backend names
+		options.backends.clear();
+		
+		size_t start = 10;
+		while (start <= arg.size())
+		{
+			size_t end = arg.find(',', start);
+			if (end == string::npos)
+				end = arg.size();
+			
+			string name = arg.substr(start, end - start);
+			int b = 0;
+			while (b < NUM_BACKENDS && name != backendNames[b])
+				b++;
+			
+			if (b == NUM_BACKENDS)
+				return false;
+			
+			options.backends.push_back((Backend)b);
+			start = end + 1;
+		}
+	}
+	else if (arg.compare(0, 10, "--threads=") == 0)
+		options.numThreads = atoi(arg.c_str() + 10);
+	else if (arg.compare(0, 8, "--chunk=") == 0)
+		options.chunkRows = atoi(arg.c_str() + 8);
+	else if (arg == "--calibrate")
+		options.calibrate = true;
+	else if (arg == "--roofline")
+		options.roofline = true;
+	else if (arg.compare(0, 8, "--trace=") == 0)
+		options.tracePath = arg.substr(8);
+	else if (arg.compare(0, 6, "--top=") == 0)
+		options.topSegments = atoi(arg.c_str() + 6);
+	else if (arg.compare(0, 15, "--steeper-than=") == 0)
+		options.steeperThan = atof(arg.c_str() + 15);
+	else if (arg.compare(0, 7, "--hits=") == 0)
+		options.hitsPath = arg.substr(7);
+	else if (arg.compare(0, 10, "--regions=") == 0)
+		options.regionThreshold = atof(arg.c_str() + 10);
+	else if (arg.compare(0, 15, "--regions-file=") == 0)
+		options.regionsPath = arg.substr(15);
+	else if (arg == "--stream")
+		options.streamPath = "-";
+	else if (arg.compare(0, 9, "--stream=") == 0)
+		options.streamPath = arg.substr(9);
+	else if (arg.compare(0, 15, "--stream-batch=") == 0)
+		options.streamBatchRows = atoi(arg.c_str() + 15);
+	else if (arg.compare(0, 16, "--stream-output=") == 0)
+		options.streamOutputPath = arg.substr(16);
+	else if (arg == "--pyramid")
+		options.pyramidLevels = INT32_MAX;
+	else if (arg.compare(0, 10, "--pyramid=") == 0)
+		options.pyramidLevels = atoi(arg.c_str() + 10);
+	else if (arg.compare(0, 10, "--preview=") == 0)
+	{
+		//FILE or FILE,LEVEL
+		options.previewPath = arg.substr(10);
+		size_t comma = options.previewPath.rfind(',');
+		
+		if (comma != string::npos)
+		{
+			options.previewLevel = atoi(options.previewPath.c_str() + comma + 1);
+			options.previewPath.erase(comma);
+		}
+	}
+	else if (arg == "--telemetry")
+		options.telemetryInterval = DEFAULT_TELEMETRY_INTERVAL;
+	else if (arg.compare(0, 12, "--telemetry=") == 0)
+		options.telemetryInterval = atof(arg.c_str() + 12);
+	else if (arg.compare(0, 17, "--telemetry-file=") == 0)
+	{
+		//a snapshot file is no use without samples to fill it, so this turns sampling on if it is not already
+		options.telemetryPath = arg.substr(17);
+		if (options.telemetryInterval <= 0)
+			options.telemetryInterval = DEFAULT_TELEMETRY_INTERVAL;
+	}
+	else if (arg.compare(0, 10, "--convert=") == 0)
+		options.convertPath = arg.substr(10);
+	else if (arg.compare(0, 14, "--out-of-core=") == 0)
+		options.outOfCorePath = arg.substr(14);
+	else if (arg.compare(0, 10, "--results=") == 0)
+		options.resultsPath = arg.substr(10);
+	else if (arg.compare(0, 8, "--input=") == 0)
+		options.inputPath = arg.substr(8);
+	else if (arg.compare(0, 15, "--save-results=") == 0)
+		options.saveResultsPath = arg.substr(15);
+	else if (arg == "--compress" || arg == "--compress=lz4")
+	{
+		options.compress = true;
+		options.codec = CODEC_LZ4;
+	}
+	else if (arg == "--compress=zstd")
+	{
+		options.compress = true;
+		options.codec = CODEC_ZSTD;
+	}
+	else if (arg.compare(0, 10, "--sharded=") == 0)
+		options.shardedPath = arg.substr(10);
+	else if (arg.compare(0, 12, "--processes=") == 0)
+		options.numProcesses = atoi(arg.c_str() + 12);
+	else if (arg.compare(0, 13, "--shard-rows=") == 0)
+		options.shardRows = atoi(arg.c_str() + 13);
+	else if (arg == "--shard-store=shm")
+		options.shardSharedMemory = true;
+	else if (arg == "--shard-store=file")
+		options.shardSharedMemory = false;
+	else if (arg.compare(0, 15, "--shard-worker=") == 0)
+		options.shardWorker = arg.substr(15);
+	else if (arg.compare(0, 8, "--batch=") == 0)
+		options.batchPath = arg.substr(8);
+	else if (arg.compare(0, 16, "--memory-budget=") == 0)
+	{
+		//comma-separated list of budgets in megabytes
+		options.memoryBudgets.clear();
+		
+		const char* list = arg.c_str() + 16;
+		while (*list != '\0')
+		{
+			char* end;
+			options.memoryBudgets.push_back((int)strtol(list, &end, 10));
+			
+			if (end == list || (*end != ',' && *end != '\0'))
+				return false;
+			
+			list = *end == ',' ? end + 1 : end;
+		}
+	}
+	//profile options were dealt with before the profile was loaded
+	else if (arg.compare(0, 10, "--profile=") == 0 || arg == "--no-profile")
+		return true;
+	else
+		return false;
+	
+	return true;
+}
+
+bool loadProfile(void)
+{
+	ifstream profile(options.profilePath.c_str());
+	
+	if (!profile.is_open())
+		return false;
+	
+	//the profile holds one command line option per line, with lines starting with # used as comments
+	string line;
+	while (getline(profile, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		
+		if (!applyOption(line))
+			cout << "Warning! Ignoring unrecognised setting \"" << line << "\" in " << options.profilePath << "." << endl;
+	}
+	
+	return true;
+}
+
+int availableCpuCount(void)
+{
+	//CPUs this process is allowed to run on (e.g. restricted by taskset or a container's cpuset)
+	int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	
+	cpu_set_t affinity;
+	if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+		cpus = CPU_COUNT(&affinity);
+	
+	//a cgroup CPU quota limits how much CPU time the process gets, however many CPUs it may run on
+	//cgroup v2 gives "quota period" (or "max period") in cpu.max, cgroup v1 uses two separate files
+	long long quota = -1;
+	long long period = -1;
+	
+	ifstream cpuMax("/sys/fs/cgroup/cpu.max");
+	if (cpuMax.is_open())
+	{
+		string quotaText;
+		cpuMax >> quotaText >> period;
+		
+		if (quotaText != "max")
+			quota = atoll(quotaText.c_str());
+	}
+	else
+	{
+		ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+		ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+		
+		if (quotaFile.is_open() && periodFile.is_open())
+			quotaFile >> quota, periodFile >> period;
+	}
+	
+	if (quota > 0 && period > 0)
+	{
+		int quotaCpus = (int)((quota + period - 1) / period);
+		cpus = min(cpus, quotaCpus);
+	}
+	
+	return max(cpus, 1);
+}
+
+double timeProcessingRun(ThreadData* data, pthread_t* threads, int numThreads)
+{
+	partitionRows(data, numThreads, 0, options.arrayHeight);
+	
+	double start = wallTime();
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, processRows, (void*)&data[i]);
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	return wallTime() - start;
+}
+
+void calibrate(void)
+{
+	int cpus = availableCpuCount();
+	
+	//trials use a slice of the array height so that calibration only takes a few seconds
+	options.arrayHeight = min(options.arrayHeight, CALIBRATION_ROWS);
+	
+	//generate heights in the same format as generateRandomNumberFile, so the lookup kernel can be tried as well
+	float** mainArray = setup2DArrayOnHeap<float>();
+	srand(time(NULL));
+	
+	for (int i = 0; i < options.arrayHeight; i++)
+	{
+		for (int j = 0; j < options.arrayWidth; j++)
+		{
+			int whole = rand() % 999 + 1;
+			int fraction = rand() % 999 + 1;
+			double scale = fraction < 10 ? 10 : (fraction < 100 ? 100 : 1000);
+			mainArray[i][j] = (float)((whole * scale + fraction) / scale);
+		}
+	}
+	
+	ResultGrid results = setupResultGrid(options.layout);
+	buildSlopeTable();
+	
+	//thread counts to try: powers of two up to the number of usable CPUs, the number of usable CPUs itself,
+	//and twice that (to see whether oversubscription helps hide stalls)
+	int threadCounts[32];
+	int numThreadCounts = 0;
+	
+	for (int count = 1; count < cpus; count *= 2)
+		threadCounts[numThreadCounts++] = count;
+	threadCounts[numThreadCounts++] = cpus;
+	threadCounts[numThreadCounts++] = 2 * cpus;
+	
+	//chunk sizes to try, with 0 meaning one fixed range of rows per thread (the original behaviour)
+	int chunkSizes[] = { 0, 1, 8, 64, 256 };
+	int numChunkSizes = sizeof(chunkSizes) / sizeof(chunkSizes[0]);
+	
+	bool specialised;
+	RowRangeKernel kernels[2] = { selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialised), processRowRangeLookup };
+	const char* kernelNames[2] = { "math", "lookup" };
+	
+	ThreadData* data = new ThreadData[2 * cpus];
+	pthread_t* threads = new pthread_t[2 * cpus];
+	
+	for (int i = 0; i < 2 * cpus; i++)
+	{
+		data[i].mainArray = mainArray;
+		data[i].results = results;
+		data[i].threadIndex = i;
+		data[i].traceBuffer = NULL;
+		data[i].finishTicks = 0;
+	}
+	
+	cout << "Calibrating on " << options.arrayHeight << " x " << options.arrayWidth << " points with up to " << cpus << " usable CPUs.\n";
+	cout << "Threads | chunk | kernel | stores | seconds | million points/s\n";
+	
+	double bestTime = 0;
+	int bestThreads = 1, bestChunk = 0, bestKernel = 0;
+	bool bestStreaming = false;
+	
+	for (int t = 0; t < numThreadCounts; t++)
+	{
+		int numThreads = min(threadCounts[t], options.arrayHeight);
+		
+		for (int c = 0; c < numChunkSizes; c++)
+		{
+			for (int k = 0; k < 2; k++)
+			{
+				//streaming stores are not tried if rows are read back as they are written (see useStreamingStores())
+				for (int streaming = 0; streaming < (rowsReadBack() ? 1 : 2); streaming++)
+				{
+					options.chunkRows = chunkSizes[c];
+					
+					for (int i = 0; i < numThreads; i++)
+					{
+						data[i].kernel = kernels[k];
+						data[i].streamingStores = streaming != 0;
+						data[i].lookupFallbackRows = 0;
+					}
+					
+					//keep the fastest of a few repeats, to filter out noise from other processes
+					double trialTime = 0;
+					for (int repeat = 0; repeat < CALIBRATION_REPEATS; repeat++)
+					{
+						double runTime = timeProcessingRun(data, threads, numThreads);
+						if (repeat == 0 || runTime < trialTime)
+							trialTime = runTime;
+					}
+					
+					cout << numThreads << " | " << chunkSizes[c] << " | " << kernelNames[k] << " | " << (streaming ? "streaming" : "normal") << " | "
+						<< trialTime << " | " << ((double)options.arrayHeight * options.arrayWidth / trialTime / 1e6) << "\n";
+					
+					if (bestTime == 0 || trialTime < bestTime)
+					{
+						bestTime = trialTime;
+						bestThreads = numThreads;
+						bestChunk = chunkSizes[c];
+						bestKernel = k;
+						bestStreaming = streaming != 0;
+					}
+				}
+			}
+		}
+	}
+	
+	//save the fastest settings in the same form as command line options, so loading them is the same as passing them in
+	ofstream profile(options.profilePath.c_str(), ios::trunc);
+	
+	if (!profile.is_open())
+		cout << "Error! Could not write profile to " << options.profilePath << "." << endl;
+	else
+	{
+		time_t now = time(NULL);
+		profile << "# written by cw1Part3 --calibrate on " << ctime(&now);
+		profile << "# " << cpus << " usable CPUs, best trial " << bestTime << " seconds for " << options.arrayHeight << " x " << options.arrayWidth << " points\n";
+		profile << "--threads=" << bestThreads << "\n";
+		profile << "--chunk=" << bestChunk << "\n";
+		profile << "--kernel=" << kernelNames[bestKernel] << "\n";
+		profile << "--stores=" << (bestStreaming ? "streaming" : "normal") << "\n";
+		
+		cout << "Fastest settings: " << bestThreads << " threads, " << (bestChunk == 0 ? "one range of rows per thread" : "chunks of " + to_string(bestChunk) + " rows")
+			<< ", " << kernelNames[bestKernel] << " kernel, "
+			<< (bestStreaming ? "streaming" : "normal") << " stores - saved to " << options.profilePath << ".\n";
+	}
+	
+	//time the fastest settings with the per-row telemetry counter updates on and off in turn, so that both see the same
+	//conditions - the uncounted runs get no counters from telemetryProgress(), just as when --telemetry is not given
+	//only the counting is switched, so a sampler started by --telemetry carries on at its own interval throughout
+	double countedTime = 0, uncountedTime = 0;
+	options.chunkRows = bestChunk;
+	
+	for (int i = 0; i < bestThreads; i++)
+	{
+		data[i].kernel = kernels[bestKernel];
+		data[i].streamingStores = bestStreaming;
+	}
+	
+	for (int repeat = 0; repeat < TELEMETRY_OVERHEAD_REPEATS; repeat++)
+	{
+		setTelemetryCounting(true);
+		double runTime = timeProcessingRun(data, threads, bestThreads);
+		if (repeat == 0 || runTime < countedTime)
+			countedTime = runTime;
+		
+		setTelemetryCounting(false);
+		runTime = timeProcessingRun(data, threads, bestThreads);
+		if (repeat == 0 || runTime < uncountedTime)
+			uncountedTime = runTime;
+	}
+	
+	setTelemetryCounting(options.telemetryInterval > 0);
+	
+	cout << "Telemetry counters cost " << (100.0 * (countedTime - uncountedTime) / uncountedTime) << "% of processing time with the fastest settings ("
+		<< countedTime << " seconds with them, " << uncountedTime << " seconds without).\n";
+	
+	delete[] data;
+	delete[] threads;
+	delete2DArray<float>(mainArray);
+	deleteResultGrid(results);
+	delete[] slopeTable;
+	slopeTable = NULL;
+}
+
+//barriers the pool of worker threads waits at before and after each processing run (or each file in batch mode)
+//main() is the extra party at both, so in batch mode it can load and save files while the workers process rows
+static pthread_barrier_t poolStartBarrier;
+static pthread_barrier_t poolDoneBarrier;
+
+//set by main() before releasing the pool for the last time, to tell the workers there is no more work
+static bool poolShutdown = false;
+
+//wall-clock time main() released the pool to start the current run - each worker sets its timeTaken relative to this
+double poolStepStart;
+
+void* poolWorker(void* data)
+{
+	ThreadData* threadData = (ThreadData*)data;
+	threadData->traceBuffer = traceThread("pool worker " + to_string(threadData->threadIndex));
+	
+	while (true)
+	{
+		pthread_barrier_wait(&poolStartBarrier);
+		
+		if (poolShutdown)
+			break;
+		
+		processAssignedRows(threadData);
+		threadData->finishTicks = traceTimestamp();
+		threadData->timeTaken = wallTime() - poolStepStart;
+		
+		pthread_barrier_wait(&poolDoneBarrier);
+	}
+	
+	return NULL;
+}
+
+void startThreadPool(ThreadData* data, pthread_t* threads, int numThreads)
+{
+	pthread_barrier_init(&poolStartBarrier, NULL, numThreads + 1);
+	pthread_barrier_init(&poolDoneBarrier, NULL, numThreads + 1);
+	poolShutdown = false;
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, poolWorker, (void*)&data[i]);
+}
+
+void releaseThreadPool(void)
+{
+	poolStepStart = wallTime();
+	pthread_barrier_wait(&poolStartBarrier);
+}
+
+void waitForThreadPool(void)
+{
+	pthread_barrier_wait(&poolDoneBarrier);
+}
+
+void stopThreadPool(pthread_t* threads, int numThreads)
+{
+	poolShutdown = true;
+	pthread_barrier_wait(&poolStartBarrier);
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	pthread_barrier_destroy(&poolStartBarrier);
+	pthread_barrier_destroy(&poolDoneBarrier);
+}
+
+bool backendAvailable(Backend backend)
+{
+	switch (backend)
+	{
+		case BACKEND_OPENMP_STATIC:
+		case BACKEND_OPENMP_DYNAMIC:
+#ifdef _OPENMP
+			return true;
+#else
+			return false;
+#endif
+		case BACKEND_PAR:
+#ifdef USE_STD_EXECUTION
+			return true;
+#else
+			return false;
+#endif
+		default:
+			return true;
+	}
+}
+
+int processRowsWithBackend(Backend backend, ThreadData* data, int numThreads)
+{
+	//both kinds of backend work through the array in blocks of rows, in place of the ranges set by partitionRows()
+	int blockRows = options.chunkRows > 0 ? options.chunkRows : BACKEND_BLOCK_ROWS;
+	int numBlocks = (options.arrayHeight + blockRows - 1) / blockRows;
+	
+#ifdef _OPENMP
+	if (backend == BACKEND_OPENMP_STATIC || backend == BACKEND_OPENMP_DYNAMIC)
+	{
+		//a static schedule with no chunk size gives each thread one contiguous range of blocks, as partitionRows() does,
+		//while a dynamic schedule hands blocks out one at a time, as the chunked pthreads scheduling does
+		omp_set_schedule(backend == BACKEND_OPENMP_DYNAMIC ? omp_sched_dynamic : omp_sched_static, backend == BACKEND_OPENMP_DYNAMIC ? 1 : 0);
+		double runStart = wallTime();
+		int threadsUsed = numThreads;
+		
+		#pragma omp parallel num_threads(numThreads)
+		{
+			//the implementation may give the region fewer threads than were asked for
+			if (omp_get_thread_num() == 0)
+				threadsUsed = omp_get_num_threads();
+			
+			//OpenMP keeps its threads between parallel regions, so each is only named in the trace the first time it is used
+			ThreadData* threadData = &data[omp_get_thread_num()];
+			threadData->traceBuffer = currentTrace();
+			if (threadData->traceBuffer == NULL)
+				threadData->traceBuffer = traceThread("openmp thread " + to_string(omp_get_thread_num()));
+			
+			#pragma omp for schedule(runtime) nowait
+			for (int block = 0; block < numBlocks; block++)
+			{
+				threadData->currentRow = block * blockRows;
+				threadData->rowsToProcess = min(blockRows, options.arrayHeight - threadData->currentRow);
+				
+				uint64_t blockTraceStart = traceTimestamp();
+				threadData->kernel(threadData);
+				traceSpan("rows", blockTraceStart, traceTimestamp(), threadData->currentRow, threadData->rowsToProcess);
+			}
+			
+			threadData->finishTicks = traceTimestamp();
+			threadData->timeTaken = wallTime() - runStart;
+		}
+		
+		return threadsUsed;
+	}
+#endif
+	
+#ifdef USE_STD_EXECUTION
+	if (backend == BACKEND_PAR)
+	{
+		//the library decides how many threads to use and which runs which block, so every block gets its own copy of
+		//the first ThreadData object and its own count of lookup fallbacks - the blocks are not traced, as trace buffers
+		//belong to named threads
+		//this is par rather than par_unseq, as the kernels are not safe to interleave within one thread: the first use of a
+		//thread's telemetry block or segment collector allocates it and takes a lock, the lookup kernel allocates scratch
+		//rows, and the progress counters and the pyramid are updated with atomics
+		vector<int> blocks(numBlocks);
+		vector<int> blockFallbackRows(numBlocks, 0);
+		vector<pthread_t> blockThreads(numBlocks);
+		iota(blocks.begin(), blocks.end(), 0);
+		
+		const ThreadData& prototype = data[0];
+		double runStart = wallTime();
+		
+		for_each(execution::par, blocks.begin(), blocks.end(), [&](int block)
+		{
+			ThreadData blockData = prototype;
+			blockData.currentRow = block * blockRows;
+			blockData.rowsToProcess = min(blockRows, options.arrayHeight - blockData.currentRow);
+			blockData.lookupFallbackRows = 0;
+			blockData.kernel(&blockData);
+			blockFallbackRows[block] = blockData.lookupFallbackRows;
+			blockThreads[block] = pthread_self();
+		});
+		
+		//the time and fallbacks of the whole loop are given to the first ThreadData object, as no one thread owns them
+		for (int i = 0; i < numThreads; i++)
+		{
+			data[i].timeTaken = 0;
+			data[i].lookupFallbackRows = 0;
+		}
+		
+		data[0].timeTaken = wallTime() - runStart;
+		for (int block = 0; block < numBlocks; block++)
+			data[0].lookupFallbackRows += blockFallbackRows[block];
+		
+		//the number of threads the library chose is only known from which threads ran the blocks
+		sort(blockThreads.begin(), blockThreads.end());
+		return (int)(unique(blockThreads.begin(), blockThreads.end()) - blockThreads.begin());
+	}
+#endif
+	
+	//backends this build does not include are rejected by parseOptions()
+	(void)backend;
+	(void)data;
+	(void)numBlocks;
+	return numThreads;
 }
 
 //remove
@@ -312,7 +2274,7 @@ void compareArrayValues(float** mainArray, float** resultArray, int height, int
 {
 	int nextVal = width + 1;
 	
-	if (nextVal == ARRAY_WIDTH)
+	if (nextVal == options.arrayWidth)
 		nextVal = 0;
 	
 	cout << "Height 1: " << mainArray[height][width] << endl;
@@ -0,0 +1,497 @@
+//declarations shared by every source file of cw1Part3 - the types, options and functions each subsystem uses
+#ifndef CW1PART3_H
+#define CW1PART3_H
+
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+#include <string>
+#include <cmath>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//the openmp-static and openmp-dynamic backends are only available if the program is built with -fopenmp, and the
+//par backend (C++17 parallel algorithms) only if it is built with -DUSE_STD_EXECUTION -ltbb
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef USE_STD_EXECUTION
+#include <execution>
+#include <numeric>
+#endif
+
+using namespace std;
+
+//default height and width of 2D arrays (can be changed at run time with --width and --height)
+#define ARRAY_WIDTH 1000
+#define ARRAY_HEIGHT 50000
+
+//horizontal distance between heights stored in each row of main array
+//remains the same between every point and its immediate neighbours in row
+//so long as this value is constant, its actual number value is unimportant
+//this is the default - it can be changed at run time with --spacing
+#define HORIZONTAL_POINT_DIST 50
+
+//default number of threads to split array between (can be changed at run time with --threads or by a host profile)
+#define NUM_THREADS 50000
+
+//number of rows used for each trial in calibration mode, and the number of times each trial is repeated (the fastest is kept)
+#define CALIBRATION_ROWS 8192
+#define CALIBRATION_REPEATS 3
+
+//used to convert return value of asin() from radians to degrees
+#define DEGREES_PER_RADIAN 57.2958
+
+//size of a huge page on x86-64 - float grids are allocated in multiples of this so they can be backed by huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+//size of a cache line in bytes - per-thread data and the start of every row of a float grid are aligned to this
+//so that two threads never write to the same cache line (which would make the line bounce between cores)
+#define CACHE_LINE_SIZE 64
+
+//the lookup kernel handles heights h with 0 <= h < LOOKUP_HEIGHT_LIMIT that are a whole number of thousandths
+//(as written by generateRandomNumberFile) - each height is scaled by LOOKUP_SCALE to an integer, so the difference
+//between two heights is an integer between -LOOKUP_MAX_DIFF and LOOKUP_MAX_DIFF, which indexes the table
+#define LOOKUP_HEIGHT_LIMIT 1000
+#define LOOKUP_SCALE 1000
+#define LOOKUP_MAX_DIFF (LOOKUP_HEIGHT_LIMIT * LOOKUP_SCALE - 1)
+
+//number of points in each block of a row when results use LAYOUT_BLOCKED
+//8 distances and 8 angles fill one 64-byte cache line (and one 256-bit vector each)
+#define RESULT_BLOCK_SIZE 8
+
+//size of a normal page - used when pre-faulting grids by touching one value per page
+#define SMALL_PAGE_SIZE 4096
+
+//identifies a binary grid file (written by --convert and by out-of-core runs), and the version of its layout
+#define GRID_FILE_MAGIC "CW1G"
+#define GRID_FILE_VERSION 1
+
+//number of rows in each block the OpenMP and par backends share out, unless --chunk gives another size
+#define BACKEND_BLOCK_ROWS 16
+
+//ways in which the memory for the float grids can be backed
+//HUGE_PAGES_NONE leaves the choice to the kernel's defaults, HUGE_PAGES_THP asks for transparent huge pages using madvise()
+//and HUGE_PAGES_HUGETLB requests pages from the hugetlbfs pool (falling back to THP if the pool is empty)
+enum HugePageMode
+{
+	HUGE_PAGES_NONE,
+	HUGE_PAGES_THP,
+	HUGE_PAGES_HUGETLB
+};
+
+//how processRows writes its results to distanceArray and angleArray
+//STORES_NORMAL uses ordinary stores, which read each destination cache line into the cache before writing to it,
+//STORES_STREAMING uses non-temporal stores which write straight to memory without reading the line first (the results
+//are never read back during the run, so caching them only doubles write traffic and evicts the input rows),
+//STORES_AUTO picks streaming stores when the result arrays are too big to stay in the last level cache anyway
+//and STORES_BOTH processes the array once with each kind of store so their bandwidth can be compared
+enum StoreMode
+{
+	STORES_AUTO,
+	STORES_NORMAL,
+	STORES_STREAMING,
+	STORES_BOTH
+};
+
+//how the distance and angle results are laid out in memory
+//LAYOUT_PLANES stores them in two separate grids (distanceArray and angleArray), giving two output streams per point,
+//LAYOUT_INTERLEAVED stores {distance, angle} pairs next to each other in a single grid, giving one output stream,
+//and LAYOUT_BLOCKED stores rows as blocks of RESULT_BLOCK_SIZE distances followed by the same points' angles (AoSoA)
+//so that each block fills exactly one cache line but distances and angles can still be loaded as whole vectors
+enum ResultLayout
+{
+	LAYOUT_PLANES,
+	LAYOUT_INTERLEAVED,
+	LAYOUT_BLOCKED
+};
+
+//which kind of kernel calculates the results
+//KERNEL_MATH works out every square root and arcsine, KERNEL_LOOKUP reads them from a precomputed table indexed by the
+//difference between two heights (possible because heights only have three decimal places) and KERNEL_BOTH runs each in turn
+enum KernelMode
+{
+	KERNEL_MATH,
+	KERNEL_LOOKUP,
+	KERNEL_BOTH
+};
+
+//how the rows are shared out between threads and the kernel run over them
+//BACKEND_PTHREADS creates and joins a thread per run, BACKEND_OPENMP_STATIC and BACKEND_OPENMP_DYNAMIC use an OpenMP
+//parallel for over blocks of rows, BACKEND_PAR uses std::for_each with std::execution::par over the same blocks
+//and BACKEND_POOL keeps one set of threads waiting at a barrier between runs
+enum Backend
+{
+	BACKEND_PTHREADS,
+	BACKEND_OPENMP_STATIC,
+	BACKEND_OPENMP_DYNAMIC,
+	BACKEND_PAR,
+	BACKEND_POOL,
+	NUM_BACKENDS
+};
+
+//codec used for the blocks of a compressed grid file
+//CODEC_STORED is only used for single blocks which did not get any smaller when compressed
+enum BlockCodec
+{
+	CODEC_STORED,
+	CODEC_LZ4,
+	CODEC_ZSTD
+};
+
+//options chosen on the command line at run time
+struct RunOptions
+{
+	HugePageMode hugePages;
+	
+	//if set, every float grid (heights and results) is faulted in as it is allocated, split into even ranges of rows
+	//between up to one thread per CPU - this takes the page faults out of the loading and processing sections and
+	//spreads the grid's pages over the memory nodes the threads run on
+	bool prefault;
+	
+	StoreMode stores;
+	
+	ResultLayout layout;
+	
+	//dimensions of the arrays and horizontal distance between points for this run
+	int arrayWidth;
+	int arrayHeight;
+	float pointSpacing;
+	
+	//true if the kernel should do its square root and arcsine in double rather than single precision
+	bool doublePrecision;
+	
+	//if set, compare the speed of the two array.txt loaders instead of processing the array
+	bool parseBenchmark;
+	
+	KernelMode kernelMode;
+	
+	//backends the rows are processed with - each kernel and kind of store is run once with every backend listed
+	vector<Backend> backends;
+	
+	int numThreads;
+	
+	//number of rows a thread takes at a time from a shared counter, or 0 to split the rows into one fixed range per thread
+	int chunkRows;
+	
+	//if set, time short trials of different thread counts, chunk sizes and kernels and save the fastest as this host's profile
+	bool calibrate;
+	
+	//if set, measure the host's bandwidth and float throughput and how close each kernel variant comes to them
+	bool roofline;
+	
+	//file holding this host's profile - loaded before the command line is read, unless useProfile has been turned off
+	string profilePath;
+	bool useProfile;
+	
+	//if not empty, a timeline of what every thread did is written to this file in Chrome trace-event JSON format
+	string tracePath;
+	
+	//if topSegments is greater than 0, the kernels keep the topSegments steepest segments (by absolute angle) as they go,
+	//and if steeperThan is 0 or more they list every segment steeper than that many degrees - the list is written to
+	//hitsPath if it is not empty - both are gathered while each row is still in cache, rather than in a second pass
+	int topSegments;
+	float steeperThan;
+	string hitsPath;
+	
+	//if regionThreshold is 0 or more, connected regions of segments steeper than that many degrees are labelled after
+	//processing, once with each thread count up to numThreads to compare them - every region is written to regionsPath
+	//if it is not empty
+	float regionThreshold;
+	string regionsPath;
+	
+	//number of pyramid levels built alongside the results (0 for none), each halving the width and height of the one
+	//below - the pyramid is saved with the results by --save-results, and previewPath is a results file whose pyramid
+	//is read (previewLevel, or the coarsest level with at least PREVIEW_CELLS cells if previewLevel is 0) instead of processing
+	int pyramidLevels;
+	string previewPath;
+	int previewLevel;
+	
+	//if not empty, rows of heights are read as they arrive from stdin ("-") or from connections to a Unix socket at
+	//this path, in the same text format as array.txt, and handed to the threads in batches of up to streamBatchRows rows
+	//each row's results are written to streamOutputPath (if not empty) as soon as they and every row before them are done
+	string streamPath;
+	int streamBatchRows;
+	string streamOutputPath;
+	
+	//if greater than 0, a background thread samples every thread's progress this many seconds apart, printing a line to
+	//stderr each time and (if telemetryPath is not empty) replacing telemetryPath with a Prometheus text-format snapshot
+	double telemetryInterval;
+	string telemetryPath;
+	
+	//if not empty, array.txt is loaded and written to this file as a binary grid instead of being processed
+	string convertPath;
+	
+	//if not empty, this binary grid file is processed out of core - a tile of rows at a time, with the input and results
+	//memory-mapped rather than loaded - and the results are written to resultsPath as a binary grid with two planes
+	string outOfCorePath;
+	string resultsPath;
+	
+	//largest amount of the input and results (in megabytes) an out-of-core run may keep resident at once
+	//the whole grid is processed once for each budget, so throughput can be compared between them
+	vector<int> memoryBudgets;
+	
+	//if not empty, a directory of binary grid files (or a file listing them, one per line) to process one after another
+	//with the same threads and buffers - each file's results are written next to it with ".results" added to its name
+	string batchPath;
+	
+	//if not empty, this binary grid file is split into shards of shardRows rows (0 to choose automatically) which are
+	//processed by numProcesses worker processes, attached to the grids through shared memory or (if shardSharedMemory
+	//is not set) by mapping the files themselves - the results are written to the file with ".results" added to its name
+	string shardedPath;
+	int numProcesses;
+	int shardRows;
+	bool shardSharedMemory;
+	
+	//set only in worker processes started by the coordinator, to tell them where their shards come from
+	string shardWorker;
+	
+	//if not empty, heights are loaded from this binary or compressed grid file instead of array.txt
+	string inputPath;
+	
+	//if not empty, the results are written to this file after processing
+	string saveResultsPath;
+	
+	//if set, --convert and --save-results write block-compressed grid files using this codec
+	bool compress;
+	BlockCodec codec;
+};
+
+//options for this run - set once in main() before any threads are created, read-only afterwards
+extern RunOptions options;
+
+//distance in floats between the start of one row of a float grid and the next
+//the array width is rounded up to a whole number of cache lines, so the rows at the boundary between two threads' row ranges
+//never share a cache line (1000 floats is 4000 bytes, which is not a multiple of 64) - set by parseOptions()
+extern size_t floatRowStride;
+
+//wall-clock time spent pre-faulting grids as they were allocated, reported once loading is done
+extern double prefaultTime;
+
+//next row to be handed out when threads take chunks of rows dynamically (options.chunkRows > 0),
+//and the row after the last one to be handed out - both are set by partitionRows()
+extern atomic<int> nextChunkRow;
+extern int chunkEndRow;
+
+//names of the result layouts, as used on the command line and in output
+extern const char* layoutNames[];
+
+//names of the backends, as used on the command line and in output
+extern const char* backendNames[];
+
+//distance and angle results for the whole array, in whichever layout was chosen
+//consumers should read results through distance() and angle(), which work the same way for every layout
+struct ResultGrid
+{
+	ResultLayout layout;
+	
+	//used for LAYOUT_PLANES only
+	float** distanceArray;
+	float** angleArray;
+	
+	//used for LAYOUT_INTERLEAVED and LAYOUT_BLOCKED - each row holds both the distance and the angle of every point in it
+	float** pairArray;
+	
+	float distance(int row, int column) const
+	{
+		switch (layout)
+		{
+			case LAYOUT_INTERLEAVED:
+				return pairArray[row][2 * column];
+			case LAYOUT_BLOCKED:
+				return pairArray[row][(column / RESULT_BLOCK_SIZE) * 2 * RESULT_BLOCK_SIZE + column % RESULT_BLOCK_SIZE];
+			default:
+				return distanceArray[row][column];
+		}
+	}
+	
+	float angle(int row, int column) const
+	{
+		switch (layout)
+		{
+			case LAYOUT_INTERLEAVED:
+				return pairArray[row][2 * column + 1];
+			case LAYOUT_BLOCKED:
+				return pairArray[row][(column / RESULT_BLOCK_SIZE) * 2 * RESULT_BLOCK_SIZE + RESULT_BLOCK_SIZE + column % RESULT_BLOCK_SIZE];
+			default:
+				return angleArray[row][column];
+		}
+	}
+};
+
+struct ThreadData;
+struct TraceBuffer;
+struct Pyramid;
+
+//processes all of the rows given to a thread - one version of this is compiled for each entry in the kernel table
+typedef void (*RowRangeKernel)(ThreadData* threadData);
+
+//a pointer to an object of this type will be passed to the thread function as a parameter whenever a thread is created
+//a different object will be given to each thread - this is the easiest way to avoid a race condition when different threads
+//are reading/writing to the currentRow and rowsToProcess member variables
+//each object is aligned to (and padded out to) a whole cache line, so a thread writing its timeTaken on completion
+//does not invalidate the cache line holding a neighbouring thread's data while that thread is still running
+//every member starts out with a default, so a call site which does not need one of them cannot leave it indeterminate
+struct alignas(CACHE_LINE_SIZE) ThreadData
+{	
+	float** mainArray = NULL;
+	ResultGrid results;
+	
+	int currentRow = 0;
+	int rowsToProcess = 0;
+	
+	//true if results should be written using non-temporal (streaming) stores
+	bool streamingStores = false;
+	
+	//kernel used to process the rows (specialised for this run's width and spacing if one is available)
+	RowRangeKernel kernel = NULL;
+	
+	//number of rows the lookup kernel could not handle (heights not on the 0.001 grid) and calculated arithmetically instead
+	int lookupFallbackRows = 0;
+	
+	//position of this thread among all the threads, used to name it in traces
+	int threadIndex = 0;
+	
+	//buffer the thread recorded its trace events in, and the time it finished processing (used to record how long it sat idle)
+	TraceBuffer* traceBuffer = NULL;
+	uint64_t finishTicks = 0;
+	
+	//used by a thread to return back to main function the time it took to complete (return value accessed through pthread_join())
+	//the only way a value can be returned from a thread is using a void pointer
+	//however, returning a pointer to local storage of a terminated thread will cause an access violation
+	//therefore, variable is stored locally in main instead
+	float timeTaken = 0;
+};
+
+static_assert(sizeof(ThreadData) % CACHE_LINE_SIZE == 0, "ThreadData must fill a whole number of cache lines");
+
+//counts of page faults, dTLB misses and cache misses for the whole process at one point in time
+//the dTLB and cache counters are read from perf_event_open() and are left at -1 if the kernel or hardware does not allow access to them
+struct MemoryCounters
+{
+	long minorFaults;
+	long majorFaults;
+	long long dtlbLoadMisses;
+	long long dtlbStoreMisses;
+	long long cacheMisses;
+};
+
+//distance and angle for one possible difference in height - kept together so a lookup touches a single cache line
+struct SlopeEntry
+{
+	float distance;
+	float angle;
+};
+
+//header at the start of a binary grid file
+//the header is followed by planes planes of height x width floats, one after the other, each made of rows laid end to end
+//(no padding between rows) - the first plane starts dataOffset bytes into the file, which is a whole number of pages
+//so that the data can be memory-mapped and advised in whole pages
+//input files have a single plane of heights, result files have a plane of distances followed by a plane of angles
+//result files may also hold pyramidLevels levels of a pyramid (0 in files without one) - see pyramidLevelOffset()
+struct GridFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t planes;
+	uint32_t pyramidLevels;
+	uint64_t dataOffset;
+};
+
+//table of results for every possible difference in scaled height, indexed by difference + LOOKUP_MAX_DIFF
+//built by buildSlopeTable() before any processing threads start and only read after that
+extern SlopeEntry* slopeTable;
+
+//remove
+void compareArrayValues(float** mainArray, float** resultArray, int height, int width);
+//remove
+
+bool parseOptions(int argc, char* argv[]); //fills in global options from the command line, returns false if an option is not recognised
+bool applyOption(const string& arg); //sets the option described by a single argument, returns false if it is not recognised
+bool loadProfile(void); //applies the options saved in this host's profile, returns false if there is no profile
+
+int availableCpuCount(void); //number of CPUs this process may use, taking the affinity mask and any cgroup CPU quota into account
+void calibrate(void); //runs calibration trials and writes the fastest settings to this host's profile
+
+float** setupMainArrayFromStrings(void); //original loader, which reads array.txt into strings and converts them with stof() - kept for comparison
+template <typename type> type** setup2DArrayOnHeap(void); //templated function to setup a 2D array on heap (must allocate arrays on heap due to their large size)
+template <typename type> void delete2DArray(type** array); //templated function to release memory used for a given 2D array (must be called for each array)
+
+//float grids are allocated as one contiguous block which can be backed by huge pages, so they use their own versions of these functions
+template <> float** setup2DArrayOnHeap<float>(void);
+template <> void delete2DArray<float>(float** array);
+float** setupFloatGrid(size_t rowStride); //sets up a float 2D array whose rows are rowStride floats apart
+
+ResultGrid setupResultGrid(ResultLayout layout); //allocates the grid(s) needed to hold results in the given layout
+void deleteResultGrid(ResultGrid& results); //releases memory used for results
+size_t resultRowStride(ResultLayout layout); //distance in floats between consecutive rows of each result grid
+
+//splits numRows rows starting at firstRow as evenly as possible between the given ThreadData objects
+//(and sets up the shared counter used instead when rows are handed out in chunks)
+void partitionRows(ThreadData* data, int numThreads, int firstRow, int numRows);
+
+//creates the threads, waits for them all to finish and returns the wall-clock time taken (used for calibration trials)
+double timeProcessingRun(ThreadData* data, pthread_t* threads, int numThreads);
+
+//thread function used to pre-fault a grid - touches every page in one thread's range of rows
+void* prefaultRows(void* data);
+
+//decides whether streaming stores should be used for a single processing run, given the store mode requested
+bool useStreamingStores(StoreMode mode);
+
+//true if each row of results is read back as soon as it is written, to pick out segments or build the pyramid
+bool rowsReadBack(void);
+
+double wallTime(void); //wall-clock time in seconds (clock() adds together the CPU time of every thread)
+
+void startMemoryCounters(void); //opens the perf_event dTLB counters (inherited by every thread created afterwards)
+MemoryCounters readMemoryCounters(void); //reads the current totals for page faults and dTLB misses
+void printMemoryCounters(const char* phase, MemoryCounters before, MemoryCounters after); //prints the change in each counter over a phase
+
+//thread function - takes a ThreadData pointer (which must be passed into the function as a void pointer)
+void* processRows(void* data);
+
+//picks the kernel to use from the table of specialised kernels, falling back to a generic kernel if none match
+//sets specialised to say which kind of kernel was found
+RowRangeKernel selectKernel(int width, float spacing, bool doublePrecision, bool& specialised);
+
+//persistent pool of threads, each running poolWorker() on one ThreadData - used by batch mode and the pool backend
+void* poolWorker(void* data); //pool thread function - processes its rows for one run after another until shut down
+void startThreadPool(ThreadData* data, pthread_t* threads, int numThreads); //creates the pool's threads, which wait to be released
+void releaseThreadPool(void); //starts the pool processing the rows currently given to its ThreadData objects
+void waitForThreadPool(void); //waits for every thread in the pool to finish the run it was released for
+void stopThreadPool(pthread_t* threads, int numThreads); //tells the pool's threads to exit and joins them
+extern double poolStepStart; //wall-clock time main() released the pool to start the current run
+
+bool backendAvailable(Backend backend); //true if this build includes the given backend
+int processRowsWithBackend(Backend backend, ThreadData* data, int numThreads); //processes the rows with an OpenMP or par backend, returning the threads it used
+
+void buildSlopeTable(void); //fills in the lookup kernel's table for this run's spacing, using one thread per CPU
+void processRowRangeLookup(ThreadData* threadData); //kernel which reads results from the table where possible
+
+#endif
@@ -0,0 +1,384 @@
+//batch mode - main() loads the next file and saves the last one's results while the pool processes the current one
+#include <dirent.h>
+#include <sys/uio.h>
+
+#include "cw1Part3Batch.h"
+#include "cw1Part3Trace.h"
+#include "cw1Part3Telemetry.h"
+#include "cw1Part3Pyramid.h"
+
+bool listBatchFiles(const string& path, vector<string>& files)
+{
+	struct stat fileInfo;
+	
+	if (stat(path.c_str(), &fileInfo) == -1)
+	{
+		cout << "Error! Could not open " << path << " (" << strerror(errno) << ")." << endl;
+		return false;
+	}
+	
+	if (S_ISDIR(fileInfo.st_mode))
+	{
+		//every file in the directory except hidden files and results written by earlier batches, in name order
+		DIR* directory = opendir(path.c_str());
+		
+		if (directory == NULL)
+		{
+			cout << "Error! Could not read directory " << path << " (" << strerror(errno) << ")." << endl;
+			return false;
+		}
+		
+		dirent* entry;
+		while ((entry = readdir(directory)) != NULL)
+		{
+			string name = entry->d_name;
+			
+			if (name[0] == '.' || (name.size() > 8 && name.compare(name.size() - 8, 8, ".results") == 0))
+				continue;
+			
+			string filePath = path + "/" + name;
+			if (stat(filePath.c_str(), &fileInfo) == 0 && S_ISREG(fileInfo.st_mode))
+				files.push_back(filePath);
+		}
+		
+		closedir(directory);
+		sort(files.begin(), files.end());
+	}
+	else
+	{
+		//a list of files, one per line, with lines starting with # used as comments (as in a profile)
+		ifstream list(path.c_str());
+		string line;
+		
+		while (getline(list, line))
+			if (!line.empty() && line[0] != '#')
+				files.push_back(line);
+	}
+	
+	return true;
+}
+
+//reads the header of a binary grid file, returning false (with a message) if it is not a file of heights
+static bool readGridHeader(const string& path, GridFileHeader& header)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	bool valid = fd != -1 && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+		&& memcmp(header.magic, GRID_FILE_MAGIC, 4) == 0 && header.version == GRID_FILE_VERSION;
+	
+	if (fd != -1)
+		close(fd);
+	
+	if (!valid)
+		cout << "Error! " << path << " is not a binary grid file (create one from array.txt with --convert=FILE)." << endl;
+	else if (header.planes != 1 || header.height < 1 || header.height > INT32_MAX)
+	{
+		cout << "Error! " << path << " does not hold a grid of heights." << endl;
+		valid = false;
+	}
+	
+	return valid;
+}
+
+//reads or writes height rows of a plane of a grid file, starting offset bytes into the file
+//rows in the file are laid end to end, but the rows of a float grid are floatRowStride apart, so each row is its own buffer
+bool transferRows(int fd, float** rows, int height, int width, off_t offset, bool write)
+{
+	iovec buffers[BATCH_IO_ROWS];
+	size_t rowBytes = (size_t)width * sizeof(float);
+	
+	for (int firstRow = 0; firstRow < height; firstRow += BATCH_IO_ROWS)
+	{
+		int numRows = min(BATCH_IO_ROWS, height - firstRow);
+		
+		for (int i = 0; i < numRows; i++)
+		{
+			buffers[i].iov_base = rows[firstRow + i];
+			buffers[i].iov_len = rowBytes;
+		}
+		
+		ssize_t expected = (ssize_t)(numRows * rowBytes);
+		off_t position = offset + (off_t)firstRow * rowBytes;
+		
+		if ((write ? pwritev(fd, buffers, numRows, position) : preadv(fd, buffers, numRows, position)) != expected)
+			return false;
+	}
+	
+	return true;
+}
+
+bool saveResults(const string& path, ResultGrid& results, int height, float* scratchRow, const Pyramid* pyramid)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd == -1)
+		return false;
+	
+	GridFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GRID_FILE_MAGIC, 4);
+	header.version = GRID_FILE_VERSION;
+	header.width = options.arrayWidth;
+	header.height = height;
+	header.planes = 2;
+	header.pyramidLevels = pyramid != NULL ? pyramid->levels : 0;
+	header.dataOffset = SMALL_PAGE_SIZE;
+	
+	size_t planeBytes = (size_t)height * options.arrayWidth * sizeof(float);
+	bool written = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+	
+	if (results.layout == LAYOUT_PLANES)
+	{
+		written = written && transferRows(fd, results.distanceArray, height, options.arrayWidth, header.dataOffset, true);
+		written = written && transferRows(fd, results.angleArray, height, options.arrayWidth, header.dataOffset + planeBytes, true);
+	}
+	else
+	{
+		//other layouts are split back into planes a row at a time through the result accessors
+		size_t rowBytes = (size_t)options.arrayWidth * sizeof(float);
+		
+		for (int plane = 0; plane < 2 && written; plane++)
+		{
+			for (int i = 0; i < height && written; i++)
+			{
+				for (int j = 0; j < options.arrayWidth; j++)
+					scratchRow[j] = plane == 0 ? results.distance(i, j) : results.angle(i, j);
+				
+				written = pwrite(fd, scratchRow, rowBytes, header.dataOffset + plane * planeBytes + i * rowBytes) == (ssize_t)rowBytes;
+			}
+		}
+	}
+	
+	for (int level = 1; level <= (int)header.pyramidLevels && written; level++)
+	{
+		size_t levelBytes = (size_t)pyramid->rows[level] * pyramid->columns[level] * sizeof(PyramidCell);
+		written = pwrite(fd, pyramid->cells[level], levelBytes, pyramidLevelOffset(header, level)) == (ssize_t)levelBytes;
+	}
+	
+	close(fd);
+	
+	return written;
+}
+
+//loads the heights in a binary grid file into a float grid (the file's header has already been checked)
+static bool loadGridFile(const string& path, float** grid, const GridFileHeader& header)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	
+	if (fd == -1)
+		return false;
+	
+	//the whole file is read once, front to back
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	bool loaded = transferRows(fd, grid, header.height, header.width, header.dataOffset, false);
+	
+	close(fd);
+	
+	return loaded;
+}
+
+void processBatch(void)
+{
+	traceThread("main");
+	
+	vector<string> candidates;
+	if (!listBatchFiles(options.batchPath, candidates))
+		exit(1);
+	
+	//read every header first, so the buffers can be sized once for the largest file - files must all have the same width
+	vector<string> files;
+	vector<GridFileHeader> headers;
+	int maxHeight = 0;
+	int minHeight = INT32_MAX;
+	
+	for (size_t f = 0; f < candidates.size(); f++)
+	{
+		GridFileHeader header;
+		
+		if (!readGridHeader(candidates[f], header))
+			continue;
+		
+		if (!headers.empty() && header.width != headers[0].width)
+		{
+			cout << "Error! " << candidates[f] << " is " << header.width << " wide, but the batch is " << headers[0].width << " wide - skipping it." << endl;
+			continue;
+		}
+		
+		files.push_back(candidates[f]);
+		headers.push_back(header);
+		maxHeight = max(maxHeight, (int)header.height);
+		minHeight = min(minHeight, (int)header.height);
+	}
+	
+	if (files.empty())
+	{
+		cout << "Error! No grid files to process in " << options.batchPath << "." << endl;
+		exit(1);
+	}
+	
+	//the grids are allocated once for the tallest file - shorter files just use the rows they need
+	options.arrayWidth = headers[0].width;
+	options.arrayHeight = maxHeight;
+	
+	size_t floatsPerCacheLine = CACHE_LINE_SIZE / sizeof(float);
+	floatRowStride = ((options.arrayWidth + floatsPerCacheLine - 1) / floatsPerCacheLine) * floatsPerCacheLine;
+	
+	//two sets of buffers, so one file can be loaded (and the one before it saved) while another is processed
+	float** inputs[2] = { setup2DArrayOnHeap<float>(), setup2DArrayOnHeap<float>() };
+	ResultGrid results[2] = { setupResultGrid(options.layout), setupResultGrid(options.layout) };
+	float* scratchRow = new float[options.arrayWidth];
+	
+	bool specialisedKernel;
+	RowRangeKernel kernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialisedKernel);
+	
+	if (options.kernelMode == KERNEL_LOOKUP)
+	{
+		buildSlopeTable();
+		kernel = processRowRangeLookup;
+	}
+	
+	bool streamingStores = useStreamingStores(options.stores);
+	
+	//threads are created once for the whole batch - there are never more than the shortest file has rows,
+	//so no thread is ever given a range starting beyond the end of a file
+	int numThreads = min(options.numThreads, minHeight);
+	ThreadData* data = new ThreadData[numThreads];
+	pthread_t* threads = new pthread_t[numThreads];
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		data[i].kernel = kernel;
+		data[i].streamingStores = streamingStores;
+		data[i].threadIndex = i;
+		data[i].traceBuffer = NULL;
+		data[i].lookupFallbackRows = 0;
+	}
+	
+	startThreadPool(data, threads, numThreads);
+	
+	cout << "Processing " << files.size() << " files of width " << options.arrayWidth << " with a pool of " << numThreads << " threads and "
+		<< (kernel == processRowRangeLookup ? "the lookup" : (specialisedKernel ? "a specialised" : "a generic")) << " kernel.\n";
+	
+	uint64_t batchRows = 0;
+	for (size_t f = 0; f < files.size(); f++)
+		batchRows += headers[f].height;
+	
+	setTelemetryPhase("batch", batchRows);
+	double batchStart = wallTime();
+	
+	//times for each file - loading and saving are measured on the main thread while the pool is busy with a neighbouring file,
+	//computing is the time until the pool's last thread finished, and the step is the time until both had finished
+	vector<double> loadTimes(files.size(), 0);
+	vector<double> saveTimes(files.size(), 0);
+	vector<double> computeTimes(files.size(), 0);
+	vector<double> stepTimes(files.size(), 0);
+	vector<bool> loaded(files.size(), false);
+	
+	uint64_t traceStart = traceTimestamp();
+	double start = wallTime();
+	loaded[0] = loadGridFile(files[0], inputs[0], headers[0]);
+	loadTimes[0] = wallTime() - start;
+	traceSpan("load", traceStart, traceTimestamp());
+	
+	//step n processes file n on the pool while main() saves the results of file n - 1 and loads file n + 1
+	//file n - 1's results and file n + 1's heights use the other set of buffers, so nothing the pool is using is touched
+	for (size_t n = 0; n <= files.size(); n++)
+	{
+		int current = n % 2;
+		int other = 1 - current;
+		bool computing = n < files.size() && loaded[n];
+		
+		if (computing)
+		{
+			for (int i = 0; i < numThreads; i++)
+			{
+				data[i].mainArray = inputs[current];
+				data[i].results = results[current];
+			}
+			
+			partitionRows(data, numThreads, 0, headers[n].height);
+			releaseThreadPool();
+		}
+		
+		if (n > 0 && loaded[n - 1])
+		{
+			traceStart = traceTimestamp();
+			start = wallTime();
+			
+			if (!saveResults(files[n - 1] + ".results", results[other], headers[n - 1].height, scratchRow))
+				cout << "Error! Could not write results to " << files[n - 1] << ".results." << endl;
+			
+			saveTimes[n - 1] = wallTime() - start;
+			traceSpan("save", traceStart, traceTimestamp());
+		}
+		
+		if (n + 1 < files.size())
+		{
+			traceStart = traceTimestamp();
+			start = wallTime();
+			loaded[n + 1] = loadGridFile(files[n + 1], inputs[other], headers[n + 1]);
+			loadTimes[n + 1] = wallTime() - start;
+			traceSpan("load", traceStart, traceTimestamp());
+			
+			if (!loaded[n + 1])
+				cout << "Error! Could not read " << files[n + 1] << " - skipping it." << endl;
+		}
+		
+		if (computing)
+		{
+			waitForThreadPool();
+			stepTimes[n] = wallTime() - poolStepStart;
+			
+			for (int i = 0; i < numThreads; i++)
+				computeTimes[n] = max(computeTimes[n], (double)data[i].timeTaken);
+		}
+	}
+	
+	double batchTime = wallTime() - batchStart;
+	
+	stopThreadPool(threads, numThreads);
+	
+	//a step is held up by loading and saving whenever they take longer than the pool takes to compute
+	cout << "File | rows | compute (s) | compute GB/s | load (s) | save (s) | step (s)\n";
+	
+	double totalPoints = 0, totalCompute = 0, totalLoad = 0, totalSave = 0;
+	
+	for (size_t f = 0; f < files.size(); f++)
+	{
+		totalLoad += loadTimes[f];
+		totalSave += saveTimes[f];
+		
+		if (!loaded[f])
+			continue;
+		
+		double points = (double)headers[f].height * options.arrayWidth;
+		totalPoints += points;
+		totalCompute += computeTimes[f];
+		
+		cout << files[f] << " | " << headers[f].height << " | " << computeTimes[f] << " | " << (points * sizeof(float) * 3 / computeTimes[f] / 1e9)
+			<< " | " << loadTimes[f] << " | " << saveTimes[f] << " | " << stepTimes[f] << "\n";
+	}
+	
+	//only the first load and the last save have nothing to overlap with
+	double exposedIo = loadTimes[0] + saveTimes[files.size() - 1];
+	
+	cout << "Batch of " << files.size() << " files took " << batchTime << " seconds, " << (totalPoints * sizeof(float) * 3 / batchTime / 1e9)
+		<< " GB/s overall (" << (totalPoints / batchTime / 1e6) << " million points/s), " << (totalPoints * sizeof(float) * 3 / totalCompute / 1e9)
+		<< " GB/s while computing.\n";
+	cout << "Loading took " << totalLoad << " seconds and saving " << totalSave << " seconds in total, all but " << exposedIo
+		<< " seconds of it overlapped with processing.\n";
+	
+	if (!options.tracePath.empty() && !writeTrace(options.tracePath))
+		cout << "Error! Could not write trace to " << options.tracePath << "." << endl;
+	
+	delete[] data;
+	delete[] threads;
+	delete[] scratchRow;
+	delete[] slopeTable;
+	slopeTable = NULL;
+	
+	for (int b = 0; b < 2; b++)
+	{
+		delete2DArray<float>(inputs[b]);
+		deleteResultGrid(results[b]);
+	}
+}
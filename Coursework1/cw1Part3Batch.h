@@ -0,0 +1,15 @@
+//batch mode - many grid files processed one after another by the same pool of threads, with loading and saving overlapped
+#ifndef CW1PART3BATCH_H
+#define CW1PART3BATCH_H
+
+#include "cw1Part3.h"
+
+//largest number of rows read or written by a single preadv()/pwritev() call (each row is a separate buffer)
+#define BATCH_IO_ROWS 1024
+
+void processBatch(void); //processes every file in options.batchPath with one pool of threads, loading each file while the last is processed
+bool listBatchFiles(const string& path, vector<string>& files); //lists the grid files in a directory or list file
+bool saveResults(const string& path, ResultGrid& results, int height, float* scratchRow, const Pyramid* pyramid = NULL); //writes results (and a pyramid of them) to a binary grid file, as a plane of distances followed by a plane of angles
+bool transferRows(int fd, float** rows, int height, int width, off_t offset, bool write); //reads or writes the rows of a float grid at offset in a grid file
+
+#endif
@@ -0,0 +1,596 @@
+//LZ4/CW1Z block compression - byte planes are shuffled out of each block of rows, then the blocks are shared out between threads
+//compressed grid files use liblz4 and libzstd if the program is built with -DUSE_LZ4 -llz4 and/or -DUSE_ZSTD -lzstd
+//without liblz4, a built-in implementation of the same LZ4 block format is used instead
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cw1Part3Compression.h"
+#include "cw1Part3Batch.h"
+
+#ifndef USE_LZ4
+//finds the length of the match between two positions in a block, stopping at limit
+static inline int matchLength(const uint8_t* a, const uint8_t* b, const uint8_t* limit)
+{
+	const uint8_t* start = b;
+	
+	while (b < limit && *a == *b)
+		a++, b++;
+	
+	return (int)(b - start);
+}
+
+//writes an LZ4 length continuation (the part of a length that did not fit in the 4 bits of the token)
+static inline uint8_t* writeLengthBytes(uint8_t* out, int length)
+{
+	for (; length >= 255; length -= 255)
+		*out++ = 255;
+	*out++ = (uint8_t)length;
+	
+	return out;
+}
+
+//built-in compressor producing the LZ4 block format, used when the program is built without liblz4
+//greedy matching with a single-entry hash table - it compresses less than liblz4 but its output is read by either
+//returns the compressed size, or -1 if the output would not fit in capacity bytes
+static int builtinLz4Compress(const uint8_t* source, int sourceSize, uint8_t* destination, int capacity)
+{
+	const int hashBits = 12;
+	int table[1 << hashBits];
+	memset(table, -1, sizeof(table));
+	
+	//the format requires the last 5 bytes to be literals, and the last match to start at least 12 bytes before the end
+	const uint8_t* matchLimit = source + sourceSize - 5;
+	int searchLimit = sourceSize - 12;
+	
+	uint8_t* out = destination;
+	uint8_t* outEnd = destination + capacity;
+	int anchor = 0;
+	int position = 0;
+	int misses = 0;
+	
+	while (position < searchLimit)
+	{
+		uint32_t sequence;
+		memcpy(&sequence, source + position, 4);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+		
+		int candidate = table[hash];
+		table[hash] = position;
+		
+		uint32_t candidateSequence;
+		if (candidate < 0 || position - candidate > 65535 || (memcpy(&candidateSequence, source + candidate, 4), candidateSequence != sequence))
+		{
+			//step further ahead the longer nothing has matched, so incompressible data is skipped over quickly
+			position += 1 + (misses++ >> 6);
+			continue;
+		}
+		
+		misses = 0;
+		int length = 4 + matchLength(source + candidate + 4, source + position + 4, matchLimit);
+		int literals = position - anchor;
+		
+		//token, literal length bytes, literals, offset and match length bytes in the worst case
+		if (out + 1 + literals / 255 + 1 + literals + 2 + length / 255 + 1 > outEnd)
+			return -1;
+		
+		uint8_t* token = out++;
+		*token = (uint8_t)((min(literals, 15) << 4) | min(length - 4, 15));
+		
+		if (literals >= 15)
+			out = writeLengthBytes(out, literals - 15);
+		
+		memcpy(out, source + anchor, literals);
+		out += literals;
+		
+		uint16_t offset = (uint16_t)(position - candidate);
+		*out++ = (uint8_t)offset;
+		*out++ = (uint8_t)(offset >> 8);
+		
+		if (length - 4 >= 15)
+			out = writeLengthBytes(out, length - 4 - 15);
+		
+		position += length;
+		anchor = position;
+	}
+	
+	//the block ends with a sequence of literals only
+	int literals = sourceSize - anchor;
+	
+	if (out + 1 + literals / 255 + 1 + literals > outEnd)
+		return -1;
+	
+	*out++ = (uint8_t)(min(literals, 15) << 4);
+	if (literals >= 15)
+		out = writeLengthBytes(out, literals - 15);
+	
+	memcpy(out, source + anchor, literals);
+	out += literals;
+	
+	return (int)(out - destination);
+}
+
+//built-in decompressor for the LZ4 block format - returns false if the block is corrupt or does not decompress to exactly destinationSize bytes
+static bool builtinLz4Decompress(const uint8_t* source, int sourceSize, uint8_t* destination, int destinationSize)
+{
+	const uint8_t* in = source;
+	const uint8_t* inEnd = source + sourceSize;
+	uint8_t* out = destination;
+	uint8_t* outEnd = destination + destinationSize;
+	
+	while (in < inEnd)
+	{
+		uint8_t token = *in++;
+		
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			uint8_t next;
+			do
+			{
+				if (in >= inEnd)
+					return false;
+				next = *in++;
+				literals += next;
+			} while (next == 255);
+		}
+		
+		if (literals > (size_t)(inEnd - in) || literals > (size_t)(outEnd - out))
+			return false;
+		
+		memcpy(out, in, literals);
+		in += literals;
+		out += literals;
+		
+		//the last sequence has no match
+		if (in == inEnd)
+			break;
+		
+		if (inEnd - in < 2)
+			return false;
+		
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		
+		if (offset == 0 || offset > (size_t)(out - destination))
+			return false;
+		
+		size_t length = (token & 15) + 4;
+		if ((token & 15) == 15)
+		{
+			uint8_t next;
+			do
+			{
+				if (in >= inEnd)
+					return false;
+				next = *in++;
+				length += next;
+			} while (next == 255);
+		}
+		
+		if (length > (size_t)(outEnd - out))
+			return false;
+		
+		//copied a byte at a time, as the match may overlap the bytes it is producing
+		const uint8_t* match = out - offset;
+		for (size_t i = 0; i < length; i++)
+			out[i] = match[i];
+		out += length;
+	}
+	
+	return out == outEnd;
+}
+#endif
+
+//largest size a block of the given size can compress to with a codec (for sizing output buffers)
+static size_t compressBound(size_t size)
+{
+#ifdef USE_ZSTD
+	return max(ZSTD_compressBound(size), size + size / 255 + 16);
+#else
+	return size + size / 255 + 16;
+#endif
+}
+
+//compresses a block with the given codec, returning the compressed size or 0 if it did not compress
+static size_t compressBlock(BlockCodec codec, const char* source, size_t sourceSize, char* destination, size_t capacity)
+{
+	if (codec == CODEC_LZ4)
+	{
+#ifdef USE_LZ4
+		int size = LZ4_compress_default(source, destination, (int)sourceSize, (int)capacity);
+#else
+		int size = builtinLz4Compress((const uint8_t*)source, (int)sourceSize, (uint8_t*)destination, (int)capacity);
+#endif
+		return size > 0 ? size : 0;
+	}
+	
+#ifdef USE_ZSTD
+	if (codec == CODEC_ZSTD)
+	{
+		size_t size = ZSTD_compress(destination, capacity, source, sourceSize, 1);
+		return ZSTD_isError(size) ? 0 : size;
+	}
+#endif
+	
+	return 0;
+}
+
+//decompresses a block, returning false if the codec is not available or the block is corrupt
+static bool decompressBlock(BlockCodec codec, const char* source, size_t sourceSize, char* destination, size_t destinationSize)
+{
+	switch (codec)
+	{
+		case CODEC_STORED:
+			if (sourceSize != destinationSize)
+				return false;
+			memcpy(destination, source, sourceSize);
+			return true;
+		case CODEC_LZ4:
+#ifdef USE_LZ4
+			return LZ4_decompress_safe(source, destination, (int)sourceSize, (int)destinationSize) == (int)destinationSize;
+#else
+			return builtinLz4Decompress((const uint8_t*)source, (int)sourceSize, (uint8_t*)destination, (int)destinationSize);
+#endif
+		case CODEC_ZSTD:
+#ifdef USE_ZSTD
+			return ZSTD_decompress(destination, destinationSize, source, sourceSize) == destinationSize;
+#else
+			return false;
+#endif
+	}
+	
+	return false;
+}
+
+//splits floats into four planes of bytes (all the lowest bytes, then the next bytes, and so on)
+//the sign and exponent bytes of nearby values are usually the same, so this gives the codec long runs to find
+static void shuffleBytes(const char* source, char* destination, size_t numFloats)
+{
+	for (size_t i = 0; i < numFloats; i++)
+		for (int b = 0; b < 4; b++)
+			destination[b * numFloats + i] = source[i * 4 + b];
+}
+
+static void unshuffleBytes(const char* source, char* destination, size_t numFloats)
+{
+	for (size_t i = 0; i < numFloats; i++)
+		for (int b = 0; b < 4; b++)
+			destination[i * 4 + b] = source[b * numFloats + i];
+}
+
+//what the threads compressing or decompressing a file share - blocks are taken one at a time from nextBlock,
+//so a thread that gets easily compressed blocks takes more of them
+//these are not the processing workers' partitionRows() ranges: blocks are a fixed COMPRESSED_BLOCK_ROWS rows, which
+//the workers' ranges do not line up with, block sizes vary too much for equal ranges to balance, and the transfer only
+//uses as many threads as there are CPUs rather than --threads (50000 by default)
+struct BlockTransferData
+{
+	int fd;
+	CompressedFileHeader header;
+	vector<CompressedBlockEntry>* index;
+	
+	//the grids being written or read - for heights, heights is set and results is NULL
+	float** heights;
+	const ResultGrid* results;
+	
+	atomic<int>* nextBlock;
+	
+	//when writing, the next free byte in the file - each thread reserves room for a block once it knows its size
+	atomic<uint64_t>* nextOffset;
+	
+	//set by any thread which fails, so the others stop early
+	atomic<bool>* failed;
+};
+
+//copies one row of a plane out of the grid being compressed
+static void readSourceRow(BlockTransferData* transfer, int plane, int row, float* destination)
+{
+	int width = transfer->header.width;
+	const ResultGrid* results = transfer->results;
+	
+	if (results == NULL)
+		memcpy(destination, transfer->heights[row], width * sizeof(float));
+	else if (results->layout == LAYOUT_PLANES)
+		memcpy(destination, plane == 0 ? results->distanceArray[row] : results->angleArray[row], width * sizeof(float));
+	else
+		for (int j = 0; j < width; j++)
+			destination[j] = plane == 0 ? results->distance(row, j) : results->angle(row, j);
+}
+
+void* compressBlocks(void* data)
+{
+	BlockTransferData* transfer = (BlockTransferData*)data;
+	CompressedFileHeader& header = transfer->header;
+	
+	size_t maxRawSize = (size_t)header.blockRows * header.width * sizeof(float);
+	vector<char> raw(maxRawSize), shuffled(maxRawSize), compressed(compressBound(maxRawSize));
+	
+	int blocksPerPlane = (header.height + header.blockRows - 1) / header.blockRows;
+	int numBlocks = blocksPerPlane * header.planes;
+	int block;
+	
+	while ((block = transfer->nextBlock->fetch_add(1)) < numBlocks && !*transfer->failed)
+	{
+		int plane = block / blocksPerPlane;
+		int firstRow = (block % blocksPerPlane) * header.blockRows;
+		int rows = min((int)header.blockRows, (int)header.height - firstRow);
+		size_t rawSize = (size_t)rows * header.width * sizeof(float);
+		
+		for (int i = 0; i < rows; i++)
+			readSourceRow(transfer, plane, firstRow + i, (float*)&raw[0] + (size_t)i * header.width);
+		
+		shuffleBytes(&raw[0], &shuffled[0], rawSize / sizeof(float));
+		
+		//blocks that do not get any smaller are stored as they are, so noisy data never costs more than the raw size
+		CompressedBlockEntry& entry = (*transfer->index)[block];
+		size_t size = compressBlock((BlockCodec)header.codec, &shuffled[0], rawSize, &compressed[0], compressed.size());
+		const char* blockData = &compressed[0];
+		entry.codec = header.codec;
+		
+		if (size == 0 || size >= rawSize)
+		{
+			size = rawSize;
+			blockData = &shuffled[0];
+			entry.codec = CODEC_STORED;
+		}
+		
+		entry.compressedSize = size;
+		entry.offset = transfer->nextOffset->fetch_add(size);
+		
+		if (pwrite(transfer->fd, blockData, size, entry.offset) != (ssize_t)size)
+			*transfer->failed = true;
+	}
+	
+	return NULL;
+}
+
+void* decompressBlocks(void* data)
+{
+	BlockTransferData* transfer = (BlockTransferData*)data;
+	CompressedFileHeader& header = transfer->header;
+	
+	size_t maxRawSize = (size_t)header.blockRows * header.width * sizeof(float);
+	vector<char> raw(maxRawSize), shuffled(maxRawSize), compressed;
+	
+	int blocksPerPlane = (header.height + header.blockRows - 1) / header.blockRows;
+	int block;
+	
+	while ((block = transfer->nextBlock->fetch_add(1)) < blocksPerPlane && !*transfer->failed)
+	{
+		int firstRow = block * header.blockRows;
+		int rows = min((int)header.blockRows, (int)header.height - firstRow);
+		size_t rawSize = (size_t)rows * header.width * sizeof(float);
+		
+		const CompressedBlockEntry& entry = (*transfer->index)[block];
+		compressed.resize(entry.compressedSize);
+		
+		if (entry.compressedSize > compressBound(rawSize)
+			|| pread(transfer->fd, &compressed[0], entry.compressedSize, entry.offset) != (ssize_t)entry.compressedSize
+			|| !decompressBlock((BlockCodec)entry.codec, &compressed[0], entry.compressedSize, &shuffled[0], rawSize))
+		{
+			*transfer->failed = true;
+			break;
+		}
+		
+		unshuffleBytes(&shuffled[0], &raw[0], rawSize / sizeof(float));
+		
+		for (int i = 0; i < rows; i++)
+			memcpy(transfer->heights[firstRow + i], &raw[0] + (size_t)i * header.width * sizeof(float), header.width * sizeof(float));
+	}
+	
+	return NULL;
+}
+
+//prints the compression ratio and speed of a compressed file that has just been written or read
+static void printCompressionStats(const char* action, const string& path, double rawBytes, double compressedBytes, double seconds, int numThreads)
+{
+	cout << action << " " << path << " with " << numThreads << " threads: " << (rawBytes / 1e6) << "MB raw, " << (compressedBytes / 1e6)
+		<< "MB compressed (ratio " << (rawBytes / compressedBytes) << "), " << seconds << " seconds, "
+		<< (rawBytes / 1e6 / seconds) << " MB/s of raw data.\n";
+}
+
+bool writeCompressedGrid(const string& path, float** heights, const ResultGrid* results, int height)
+{
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd == -1)
+		return false;
+	
+	BlockTransferData transfer;
+	memset(&transfer.header, 0, sizeof(transfer.header));
+	memcpy(transfer.header.magic, COMPRESSED_FILE_MAGIC, 4);
+	transfer.header.version = COMPRESSED_FILE_VERSION;
+	transfer.header.width = options.arrayWidth;
+	transfer.header.height = height;
+	transfer.header.planes = results == NULL ? 1 : 2;
+	transfer.header.blockRows = COMPRESSED_BLOCK_ROWS;
+	transfer.header.codec = options.codec;
+	
+	int blocksPerPlane = (height + COMPRESSED_BLOCK_ROWS - 1) / COMPRESSED_BLOCK_ROWS;
+	vector<CompressedBlockEntry> index(blocksPerPlane * transfer.header.planes);
+	
+	atomic<int> nextBlock(0);
+	atomic<uint64_t> nextOffset(sizeof(CompressedFileHeader));
+	atomic<bool> failed(false);
+	
+	transfer.fd = fd;
+	transfer.index = &index;
+	transfer.heights = heights;
+	transfer.results = results;
+	transfer.nextBlock = &nextBlock;
+	transfer.nextOffset = &nextOffset;
+	transfer.failed = &failed;
+	
+	//every thread compresses whole blocks on its own, so they only share the two counters
+	int numThreads = availableCpuCount();
+	vector<pthread_t> threads(numThreads);
+	double start = wallTime();
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, compressBlocks, (void*)&transfer);
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	//the index goes after the last block, and the header (which says where the index is) is written last of all
+	transfer.header.indexOffset = nextOffset;
+	size_t indexBytes = index.size() * sizeof(CompressedBlockEntry);
+	
+	bool written = !failed && pwrite(fd, &index[0], indexBytes, transfer.header.indexOffset) == (ssize_t)indexBytes
+		&& pwrite(fd, &transfer.header, sizeof(transfer.header), 0) == sizeof(transfer.header);
+	
+	close(fd);
+	
+	if (written)
+		printCompressionStats("Compressed", path, (double)transfer.header.planes * height * options.arrayWidth * sizeof(float),
+			(double)(transfer.header.indexOffset + indexBytes), wallTime() - start, numThreads);
+	
+	return written;
+}
+
+bool readCompressedHeader(int fd, CompressedFileHeader& header)
+{
+	return pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, COMPRESSED_FILE_MAGIC, 4) == 0
+		&& header.version == COMPRESSED_FILE_VERSION && header.width >= 2 && header.width <= INT32_MAX && header.height >= 1
+		&& header.height <= INT32_MAX && header.planes >= 1 && header.planes <= 2 && header.blockRows >= 1;
+}
+
+float** loadHeights(const string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	
+	if (fd == -1)
+	{
+		cout << "Error! Could not open " << path << " (" << strerror(errno) << ")." << endl;
+		exit(1);
+	}
+	
+	//the header is checked against the dimensions the grid is allocated with, which readInputDimensions() read from an
+	//earlier open of the file - if they differ, reading or decompressing the rows would run past the end of the grid
+	GridFileHeader gridHeader;
+	BlockTransferData transfer;
+	bool gridFile = pread(fd, &gridHeader, sizeof(gridHeader), 0) == sizeof(gridHeader) && memcmp(gridHeader.magic, GRID_FILE_MAGIC, 4) == 0;
+	bool valid;
+	
+	if (gridFile)
+		valid = gridHeader.version == GRID_FILE_VERSION && gridHeader.planes == 1
+			&& gridHeader.width == (uint32_t)options.arrayWidth && gridHeader.height == (uint32_t)options.arrayHeight;
+	else
+		valid = readCompressedHeader(fd, transfer.header) && transfer.header.planes == 1
+			&& transfer.header.width == (uint32_t)options.arrayWidth && transfer.header.height == (uint32_t)options.arrayHeight;
+	
+	if (!valid)
+	{
+		cout << "Error! " << path << " is not a binary or compressed grid file of " << options.arrayHeight << " x " << options.arrayWidth << " heights." << endl;
+		exit(1);
+	}
+	
+	float** mainArray = setup2DArrayOnHeap<float>();
+	
+	//uncompressed binary grid files are simply read straight into the rows
+	if (gridFile)
+	{
+		if (!transferRows(fd, mainArray, options.arrayHeight, options.arrayWidth, gridHeader.dataOffset, false))
+		{
+			cout << "Error! Could not read " << path << "." << endl;
+			exit(1);
+		}
+		
+		close(fd);
+		return mainArray;
+	}
+	
+	int blocksPerPlane = (transfer.header.height + transfer.header.blockRows - 1) / transfer.header.blockRows;
+	vector<CompressedBlockEntry> index(blocksPerPlane * transfer.header.planes);
+	size_t indexBytes = index.size() * sizeof(CompressedBlockEntry);
+	
+	if (pread(fd, &index[0], indexBytes, transfer.header.indexOffset) != (ssize_t)indexBytes)
+	{
+		cout << "Error! Could not read the block index of " << path << "." << endl;
+		exit(1);
+	}
+	
+	atomic<int> nextBlock(0);
+	atomic<bool> failed(false);
+	
+	transfer.fd = fd;
+	transfer.index = &index;
+	transfer.heights = mainArray;
+	transfer.results = NULL;
+	transfer.nextBlock = &nextBlock;
+	transfer.nextOffset = NULL;
+	transfer.failed = &failed;
+	
+	int numThreads = availableCpuCount();
+	vector<pthread_t> threads(numThreads);
+	double start = wallTime();
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, decompressBlocks, (void*)&transfer);
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	close(fd);
+	
+	if (failed)
+	{
+		cout << "Error! " << path << " has a corrupt block, or one compressed with a codec this build does not support." << endl;
+		exit(1);
+	}
+	
+	double compressedBytes = 0;
+	for (int b = 0; b < blocksPerPlane; b++)
+		compressedBytes += index[b].compressedSize;
+	
+	printCompressionStats("Decompressed", path, (double)options.arrayHeight * options.arrayWidth * sizeof(float), compressedBytes, wallTime() - start, numThreads);
+	
+	return mainArray;
+}
+
+bool readInputDimensions(void)
+{
+	int fd = open(options.inputPath.c_str(), O_RDONLY);
+	
+	if (fd == -1)
+	{
+		cout << "Error! Could not open " << options.inputPath << " (" << strerror(errno) << ")." << endl;
+		return false;
+	}
+	
+	GridFileHeader gridHeader;
+	CompressedFileHeader compressedHeader;
+	bool valid = true;
+	
+	if (pread(fd, &gridHeader, sizeof(gridHeader), 0) == sizeof(gridHeader) && memcmp(gridHeader.magic, GRID_FILE_MAGIC, 4) == 0)
+	{
+		options.arrayWidth = gridHeader.width;
+		options.arrayHeight = gridHeader.height;
+		valid = gridHeader.version == GRID_FILE_VERSION && gridHeader.planes == 1;
+	}
+	else if (readCompressedHeader(fd, compressedHeader))
+	{
+		options.arrayWidth = compressedHeader.width;
+		options.arrayHeight = compressedHeader.height;
+		valid = compressedHeader.planes == 1;
+	}
+	else
+		valid = false;
+	
+	close(fd);
+	
+	if (!valid)
+	{
+		cout << "Error! " << options.inputPath << " is not a binary or compressed grid file of heights." << endl;
+		return false;
+	}
+	
+	size_t floatsPerCacheLine = CACHE_LINE_SIZE / sizeof(float);
+	floatRowStride = ((options.arrayWidth + floatsPerCacheLine - 1) / floatsPerCacheLine) * floatsPerCacheLine;
+	
+	return true;
+}
@@ -0,0 +1,47 @@
+//LZ4/CW1Z block compression - compressed grid files, whose blocks are compressed and decompressed by many threads at once
+#ifndef CW1PART3COMPRESSION_H
+#define CW1PART3COMPRESSION_H
+
+#include "cw1Part3.h"
+
+//identifies a block-compressed grid file, and the version of its layout
+#define COMPRESSED_FILE_MAGIC "CW1Z"
+#define COMPRESSED_FILE_VERSION 1
+
+//number of rows compressed together as one block - small enough for threads to share out a file evenly,
+//big enough (256KB at the default width) for the codec to find plenty of matches
+#define COMPRESSED_BLOCK_ROWS 64
+
+//header at the start of a block-compressed grid file
+//each plane is split into blocks of blockRows rows, whose floats are split into byte planes (see shuffleBytes()) and then
+//compressed independently, so blocks can be compressed and decompressed by different threads at the same time
+//the blocks are stored in whatever order they were finished in, and found through the index at indexOffset,
+//which has one entry per block (all the blocks of the first plane, then all of the second)
+struct CompressedFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t planes;
+	uint32_t blockRows;
+	uint32_t codec;
+	uint32_t reserved;
+	uint64_t indexOffset;
+};
+
+struct CompressedBlockEntry
+{
+	uint64_t offset;
+	uint32_t compressedSize;
+	
+	//codec the block was compressed with (a BlockCodec)
+	uint32_t codec;
+};
+
+bool readInputDimensions(void); //sets the array dimensions from the header of options.inputPath
+float** loadHeights(const string& path); //loads heights from a binary or compressed grid file, decompressing blocks in parallel
+bool writeCompressedGrid(const string& path, float** heights, const ResultGrid* results, int height); //compresses heights or results in parallel
+bool readCompressedHeader(int fd, CompressedFileHeader& header); //reads and checks the header of a compressed grid file
+
+#endif
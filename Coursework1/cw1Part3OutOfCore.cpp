@@ -0,0 +1,427 @@
+//out-of-core processing - each tile's rows are advised in ahead of the threads and written back and dropped behind them
+#include "cw1Part3OutOfCore.h"
+#include "cw1Part3Trace.h"
+#include "cw1Part3Telemetry.h"
+#include "cw1Part3Tokenizer.h"
+#include "cw1Part3Compression.h"
+
+void convertToGridFile(void)
+{
+	//grid files can be converted from one kind to the other too
+	if (!options.inputPath.empty() && !readInputDimensions())
+		exit(1);
+	
+	float** mainArray = options.inputPath.empty() ? setupMainArray() : loadHeights(options.inputPath);
+	
+	if (options.compress)
+	{
+		if (!writeCompressedGrid(options.convertPath, mainArray, NULL, options.arrayHeight))
+		{
+			cout << "Error! Could not write to " << options.convertPath << "." << endl;
+			exit(1);
+		}
+		
+		delete2DArray<float>(mainArray);
+		return;
+	}
+	
+	ofstream file(options.convertPath.c_str(), ios::binary | ios::trunc);
+	
+	if (!file.is_open())
+	{
+		cout << "Error! Could not create " << options.convertPath << "." << endl;
+		exit(1);
+	}
+	
+	GridFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GRID_FILE_MAGIC, 4);
+	header.version = GRID_FILE_VERSION;
+	header.width = options.arrayWidth;
+	header.height = options.arrayHeight;
+	header.planes = 1;
+	header.dataOffset = SMALL_PAGE_SIZE;
+	
+	//the header is padded out to a whole page, then the rows are written without the padding they have in memory
+	vector<char> headerPage(SMALL_PAGE_SIZE, 0);
+	memcpy(&headerPage[0], &header, sizeof(header));
+	file.write(&headerPage[0], headerPage.size());
+	
+	for (int i = 0; i < options.arrayHeight; i++)
+		file.write((const char*)mainArray[i], options.arrayWidth * sizeof(float));
+	
+	if (!file.good())
+	{
+		cout << "Error! Could not write to " << options.convertPath << "." << endl;
+		exit(1);
+	}
+	
+	cout << "Wrote " << options.arrayHeight << " x " << options.arrayWidth << " heights to " << options.convertPath << ".\n";
+	
+	delete2DArray<float>(mainArray);
+}
+
+//fills in the row pointers of a grid file that has just been mapped
+static void setupMappedRows(MappedGrid& grid)
+{
+	size_t planeFloats = (size_t)grid.header.width * grid.header.height;
+	float* data = (float*)(grid.mapping + grid.header.dataOffset);
+	
+	grid.planes[0] = NULL;
+	grid.planes[1] = NULL;
+	
+	for (uint32_t p = 0; p < grid.header.planes; p++)
+	{
+		grid.planes[p] = new float*[grid.header.height];
+		
+		for (uint32_t i = 0; i < grid.header.height; i++)
+			grid.planes[p][i] = data + p * planeFloats + (size_t)i * grid.header.width;
+	}
+}
+
+bool mapGridFile(const string& path, MappedGrid& grid, bool writable, bool sharedMemory)
+{
+	int flags = writable ? O_RDWR : O_RDONLY;
+	grid.fd = sharedMemory ? shm_open(path.c_str(), flags, 0) : open(path.c_str(), flags);
+	struct stat fileInfo;
+	
+	if (grid.fd == -1 || fstat(grid.fd, &fileInfo) == -1)
+	{
+		cout << "Error! Could not open " << path << " (" << strerror(errno) << ")." << endl;
+		return false;
+	}
+	
+	grid.mappingSize = fileInfo.st_size;
+	
+	if (grid.mappingSize < sizeof(GridFileHeader) || pread(grid.fd, &grid.header, sizeof(grid.header), 0) != sizeof(grid.header)
+		|| memcmp(grid.header.magic, GRID_FILE_MAGIC, 4) != 0 || grid.header.version != GRID_FILE_VERSION)
+	{
+		cout << "Error! " << path << " is not a binary grid file (create one from array.txt with --convert=FILE)." << endl;
+		close(grid.fd);
+		return false;
+	}
+	
+	size_t dataSize = (size_t)grid.header.planes * grid.header.width * grid.header.height * sizeof(float);
+	
+	if (grid.header.planes < 1 || grid.header.planes > 2 || grid.header.width < 2 || grid.header.height < 1
+		|| grid.header.width > INT32_MAX || grid.header.height > INT32_MAX || grid.header.dataOffset + dataSize > grid.mappingSize)
+	{
+		cout << "Error! " << path << " has an invalid header or is shorter than its header says." << endl;
+		close(grid.fd);
+		return false;
+	}
+	
+	void* mapping = mmap(NULL, grid.mappingSize, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, grid.fd, 0);
+	
+	if (mapping == MAP_FAILED)
+	{
+		cout << "Error! Could not map " << path << " (" << strerror(errno) << ")." << endl;
+		close(grid.fd);
+		return false;
+	}
+	
+	grid.mapping = (char*)mapping;
+	
+	//rows are read once each, in order, so ask for aggressive readahead and early reclaim behind the reads
+	madvise(grid.mapping, grid.mappingSize, MADV_SEQUENTIAL);
+	
+	setupMappedRows(grid);
+	
+	return true;
+}
+
+bool createGridFile(const string& path, int width, int height, int planes, MappedGrid& grid, bool sharedMemory)
+{
+	int flags = O_RDWR | O_CREAT | O_TRUNC;
+	grid.fd = sharedMemory ? shm_open(path.c_str(), flags, 0600) : open(path.c_str(), flags, 0644);
+	
+	if (grid.fd == -1)
+	{
+		cout << "Error! Could not create " << path << " (" << strerror(errno) << ")." << endl;
+		return false;
+	}
+	
+	memset(&grid.header, 0, sizeof(grid.header));
+	memcpy(grid.header.magic, GRID_FILE_MAGIC, 4);
+	grid.header.version = GRID_FILE_VERSION;
+	grid.header.width = width;
+	grid.header.height = height;
+	grid.header.planes = planes;
+	grid.header.dataOffset = SMALL_PAGE_SIZE;
+	
+	grid.mappingSize = grid.header.dataOffset + (size_t)planes * width * height * sizeof(float);
+	
+	//the file is extended to its full size without writing anything, so its data blocks are only allocated as rows are written
+	if (ftruncate(grid.fd, grid.mappingSize) == -1 || pwrite(grid.fd, &grid.header, sizeof(grid.header), 0) != sizeof(grid.header))
+	{
+		cout << "Error! Could not set up " << path << " (" << strerror(errno) << ")." << endl;
+		close(grid.fd);
+		return false;
+	}
+	
+	void* mapping = mmap(NULL, grid.mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, grid.fd, 0);
+	
+	if (mapping == MAP_FAILED)
+	{
+		cout << "Error! Could not map " << path << " (" << strerror(errno) << ")." << endl;
+		close(grid.fd);
+		return false;
+	}
+	
+	grid.mapping = (char*)mapping;
+	madvise(grid.mapping, grid.mappingSize, MADV_SEQUENTIAL);
+	
+	setupMappedRows(grid);
+	
+	return true;
+}
+
+void unmapGridFile(MappedGrid& grid)
+{
+	munmap(grid.mapping, grid.mappingSize);
+	close(grid.fd);
+	
+	delete[] grid.planes[0];
+	delete[] grid.planes[1];
+}
+
+//works out the range of bytes in a plane of a mapped grid covered by a range of rows
+//if inner is set, the range is shrunk to the whole pages inside it (so that rows either side are left alone),
+//otherwise it is grown to the pages the rows touch - returns false if no whole pages are covered
+bool rowPages(MappedGrid& grid, int plane, int firstRow, int numRows, bool inner, size_t& offset, size_t& length)
+{
+	size_t rowBytes = (size_t)grid.header.width * sizeof(float);
+	size_t start = (char*)grid.planes[plane][firstRow] - grid.mapping;
+	size_t end = start + numRows * rowBytes;
+	
+	if (inner)
+	{
+		start = (start + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE;
+		end = end / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE;
+	}
+	else
+	{
+		start = start / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE;
+		end = min((end + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE, grid.mappingSize);
+	}
+	
+	if (end <= start)
+		return false;
+	
+	offset = start;
+	length = end - start;
+	
+	return true;
+}
+
+void adviseRows(MappedGrid& grid, int firstRow, int numRows, int advice)
+{
+	for (uint32_t p = 0; p < grid.header.planes; p++)
+	{
+		size_t offset, length;
+		
+		if (rowPages(grid, p, firstRow, numRows, false, offset, length))
+			madvise(grid.mapping + offset, length, advice);
+	}
+}
+
+void writeBackRows(MappedGrid& grid, int firstRow, int numRows)
+{
+	for (uint32_t p = 0; p < grid.header.planes; p++)
+	{
+		size_t offset, length;
+		
+		//only starts the writes - msync(MS_ASYNC) would do nothing at all on Linux
+		if (rowPages(grid, p, firstRow, numRows, false, offset, length))
+			sync_file_range(grid.fd, offset, length, SYNC_FILE_RANGE_WRITE);
+	}
+}
+
+void releaseRows(MappedGrid& grid, int firstRow, int numRows, bool writeBack)
+{
+	for (uint32_t p = 0; p < grid.header.planes; p++)
+	{
+		size_t offset, length;
+		
+		if (!rowPages(grid, p, firstRow, numRows, true, offset, length))
+			continue;
+		
+		//dirty pages have to reach the disk before they can be dropped from the page cache, not just from this process
+		if (writeBack)
+			msync(grid.mapping + offset, length, MS_SYNC);
+		
+		//unmap the pages from this process (shrinking its resident set) and then drop them from the page cache,
+		//so that the memory used really is bounded by the tiles in flight rather than growing with the file
+		madvise(grid.mapping + offset, length, MADV_DONTNEED);
+		posix_fadvise(grid.fd, offset, length, POSIX_FADV_DONTNEED);
+	}
+}
+
+//sets the peak resident set size back to the current resident set size (supported since Linux 4.0)
+static void resetResidentPeak(void)
+{
+	ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+}
+
+//peak resident set size of the process in kilobytes since it started or since resetResidentPeak(), or -1 if unavailable
+static long residentPeakKilobytes(void)
+{
+	ifstream status("/proc/self/status");
+	string line;
+	
+	while (getline(status, line))
+		if (line.compare(0, 7, "VmHWM:\t") == 0)
+			return atol(line.c_str() + 7);
+	
+	return -1;
+}
+
+void processOutOfCore(void)
+{
+	traceThread("main");
+	
+	MappedGrid input;
+	if (!mapGridFile(options.outOfCorePath, input))
+		exit(1);
+	
+	if (input.header.planes != 1)
+	{
+		cout << "Error! " << options.outOfCorePath << " holds results, not heights." << endl;
+		exit(1);
+	}
+	
+	//the kernels take their dimensions from the options, so they are replaced by the file's
+	options.arrayWidth = input.header.width;
+	options.arrayHeight = input.header.height;
+	options.layout = LAYOUT_PLANES;
+	
+	size_t floatsPerCacheLine = CACHE_LINE_SIZE / sizeof(float);
+	floatRowStride = ((options.arrayWidth + floatsPerCacheLine - 1) / floatsPerCacheLine) * floatsPerCacheLine;
+	
+	MappedGrid output;
+	if (!createGridFile(options.resultsPath, options.arrayWidth, options.arrayHeight, 2, output))
+		exit(1);
+	
+	ResultGrid results;
+	results.layout = LAYOUT_PLANES;
+	results.distanceArray = output.planes[0];
+	results.angleArray = output.planes[1];
+	results.pairArray = NULL;
+	
+	//rows in the files are not padded, so they are only 16-byte aligned (as streaming stores need) if the width is a multiple of 4
+	bool streamingStores = useStreamingStores(options.stores) && options.arrayWidth % 4 == 0;
+	
+	bool specialisedKernel;
+	RowRangeKernel kernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialisedKernel);
+	
+	if (options.kernelMode == KERNEL_LOOKUP)
+	{
+		buildSlopeTable();
+		kernel = processRowRangeLookup;
+	}
+	
+	//a thread per CPU at most - the default thread count would otherwise start tens of thousands of threads for every tile
+	int maxThreads = min(options.numThreads, availableCpuCount());
+	ThreadData* data = new ThreadData[maxThreads];
+	pthread_t* threads = new pthread_t[maxThreads];
+	
+	for (int i = 0; i < maxThreads; i++)
+	{
+		data[i].mainArray = input.planes[0];
+		data[i].results = results;
+		data[i].kernel = kernel;
+		data[i].streamingStores = streamingStores;
+		data[i].threadIndex = i;
+		data[i].traceBuffer = NULL;
+		data[i].lookupFallbackRows = 0;
+	}
+	
+	cout << "Processing " << options.outOfCorePath << " (" << options.arrayHeight << " x " << options.arrayWidth << " points) out of core with "
+		<< (kernel == processRowRangeLookup ? "the lookup" : (specialisedKernel ? "a specialised" : "a generic")) << " kernel and "
+		<< (streamingStores ? "streaming" : "normal") << " stores, results written to " << options.resultsPath << ".\n";
+	cout << "Budget (MB) | tile rows | tiles | seconds | GB/s | peak resident (MB)\n";
+	
+	setTelemetryPhase("out of core", (uint64_t)options.arrayHeight * options.memoryBudgets.size());
+	size_t rowBytes = (size_t)options.arrayWidth * sizeof(float);
+	
+	for (size_t b = 0; b < options.memoryBudgets.size(); b++)
+	{
+		//at any moment a tile is being processed (heights, distances and angles - 3 floats per point), the next tile's heights
+		//are being read ahead (1 float per point) and the previous tile's results are being written back (2 floats per point)
+		size_t budgetBytes = (size_t)options.memoryBudgets[b] * 1024 * 1024;
+		int tileRows = (int)min(budgetBytes / (6 * rowBytes), (size_t)options.arrayHeight);
+		
+		if (tileRows < 1)
+		{
+			cout << options.memoryBudgets[b] << " | budget is too small for a single row\n";
+			continue;
+		}
+		
+		int numThreads = min(maxThreads, tileRows);
+		int numTiles = (options.arrayHeight + tileRows - 1) / tileRows;
+		
+		//start each budget from a cold page cache, so that every budget has to read the input from disk
+		releaseRows(input, 0, options.arrayHeight, false);
+		releaseRows(output, 0, options.arrayHeight, true);
+		resetResidentPeak();
+		
+		double start = wallTime();
+		int previousTile = -1;
+		
+		adviseRows(input, 0, tileRows, MADV_WILLNEED);
+		
+		for (int tileStart = 0; tileStart < options.arrayHeight; tileStart += tileRows)
+		{
+			int rows = min(tileRows, options.arrayHeight - tileStart);
+			uint64_t tileTraceStart = traceTimestamp();
+			
+			//start reading the next tile's heights while this one is processed
+			if (tileStart + rows < options.arrayHeight)
+				adviseRows(input, tileStart + rows, min(tileRows, options.arrayHeight - tileStart - rows), MADV_WILLNEED);
+			
+			//the tile's rows are split between the threads exactly as the whole array is in an in-memory run
+			partitionRows(data, numThreads, tileStart, rows);
+			
+			for (int i = 0; i < numThreads; i++)
+				pthread_create(&threads[i], NULL, processRows, (void*)&data[i]);
+			
+			for (int i = 0; i < numThreads; i++)
+				pthread_join(threads[i], NULL);
+			
+			traceSpan("tile", tileTraceStart, traceTimestamp(), tileStart, rows);
+			
+			//this tile's heights are finished with, and its results can start going to disk in the background
+			releaseRows(input, tileStart, rows, false);
+			writeBackRows(output, tileStart, rows);
+			
+			//the previous tile's results have had a whole tile's processing time to be written back, so drop them now
+			if (previousTile != -1)
+				releaseRows(output, previousTile, tileRows, true);
+			
+			previousTile = tileStart;
+		}
+		
+		if (previousTile != -1)
+			releaseRows(output, previousTile, options.arrayHeight - previousTile, true);
+		
+		double processingTime = wallTime() - start;
+		long peakKilobytes = residentPeakKilobytes();
+		
+		//each point reads one float from the input file and writes a distance and an angle to the results file
+		double bytesMoved = (double)options.arrayHeight * rowBytes * 3;
+		
+		cout << options.memoryBudgets[b] << " | " << tileRows << " | " << numTiles << " | " << processingTime << " | "
+			<< (bytesMoved / processingTime / 1e9) << " | " << (peakKilobytes == -1 ? "?" : to_string(peakKilobytes / 1024)) << "\n";
+	}
+	
+	if (!options.tracePath.empty() && !writeTrace(options.tracePath))
+		cout << "Error! Could not write trace to " << options.tracePath << "." << endl;
+	
+	delete[] data;
+	delete[] threads;
+	delete[] slopeTable;
+	slopeTable = NULL;
+	unmapGridFile(input);
+	unmapGridFile(output);
+}
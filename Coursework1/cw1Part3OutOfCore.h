@@ -0,0 +1,33 @@
+//out-of-core processing - binary grid files, memory-mapped and processed a tile of rows at a time within a memory budget
+#ifndef CW1PART3OUTOFCORE_H
+#define CW1PART3OUTOFCORE_H
+
+#include "cw1Part3.h"
+
+//memory budget used for out-of-core runs if none is given with --memory-budget, in megabytes
+#define DEFAULT_MEMORY_BUDGET_MB 1024
+
+//a binary grid file mapped into memory, with a row pointer for every row of each of its planes
+//the row pointers let mapped planes be used anywhere a float grid from setup2DArrayOnHeap() can be
+struct MappedGrid
+{
+	int fd;
+	char* mapping;
+	size_t mappingSize;
+	GridFileHeader header;
+	float** planes[2];
+};
+
+void convertToGridFile(void); //loads array.txt (or options.inputPath) and writes it to options.convertPath as a binary or compressed grid
+void processOutOfCore(void); //processes options.outOfCorePath a tile at a time, once for each memory budget
+
+//grid files can also be POSIX shared memory objects, named by path, which are laid out in exactly the same way
+bool mapGridFile(const string& path, MappedGrid& grid, bool writable = false, bool sharedMemory = false); //maps an existing binary grid file
+bool createGridFile(const string& path, int width, int height, int planes, MappedGrid& grid, bool sharedMemory = false); //creates and maps a writable binary grid file
+void unmapGridFile(MappedGrid& grid); //unmaps a grid file and frees its row pointers
+void adviseRows(MappedGrid& grid, int firstRow, int numRows, int advice); //applies madvise() to a range of rows in every plane
+void writeBackRows(MappedGrid& grid, int firstRow, int numRows); //starts writing a range of rows back to the file without waiting
+void releaseRows(MappedGrid& grid, int firstRow, int numRows, bool writeBack); //drops a range of rows from memory, writing them back first if asked
+bool rowPages(MappedGrid& grid, int plane, int firstRow, int numRows, bool inner, size_t& offset, size_t& length); //page-aligned byte range of a plane covered by a range of rows
+
+#endif
@@ -0,0 +1,238 @@
+//pyramid - each row of cells is built by whichever thread completes the last row beneath it, while those rows are in cache
+#include "cw1Part3Pyramid.h"
+
+Pyramid* activePyramid = NULL;
+
+void setupPyramid(Pyramid& pyramid, int height, int width, int levels)
+{
+	pyramid.rows.assign(1, height);
+	pyramid.columns.assign(1, width);
+	pyramid.cells.assign(1, (PyramidCell*)NULL);
+	pyramid.rowsDone.assign(1, (atomic<int>*)NULL);
+	
+	//levels stop being added once a level is a single cell, however many were asked for
+	for (int level = 1; level <= levels && (pyramid.rows.back() > 1 || pyramid.columns.back() > 1); level++)
+	{
+		pyramid.rows.push_back((pyramid.rows.back() + 1) / 2);
+		pyramid.columns.push_back((pyramid.columns.back() + 1) / 2);
+		pyramid.cells.push_back(new PyramidCell[(size_t)pyramid.rows.back() * pyramid.columns.back()]);
+		pyramid.rowsDone.push_back(new atomic<int>[pyramid.rows.back()]);
+	}
+	
+	pyramid.levels = (int)pyramid.rows.size() - 1;
+	resetPyramid(pyramid);
+}
+
+void resetPyramid(Pyramid& pyramid)
+{
+	for (int level = 1; level <= pyramid.levels; level++)
+		for (int row = 0; row < pyramid.rows[level]; row++)
+			pyramid.rowsDone[level][row].store(0, memory_order_relaxed);
+}
+
+void deletePyramid(Pyramid& pyramid)
+{
+	for (int level = 1; level <= pyramid.levels; level++)
+	{
+		delete[] pyramid.cells[level];
+		delete[] pyramid.rowsDone[level];
+	}
+	
+	pyramid.levels = 0;
+}
+
+//number of points along one side of a cell at the given scale (2^level), which is less than the scale at the edge of the grid
+static inline int coveredPoints(int extent, int scale, int index)
+{
+	return min(scale, extent - index * scale);
+}
+
+//builds one row of cells of a level, from the two rows of results (level 1) or cells (higher levels) below it
+static void buildPyramidRow(Pyramid* pyramid, const ResultGrid& results, int level, int row)
+{
+	int sourceRows = pyramid->rows[level - 1];
+	int sourceColumns = pyramid->columns[level - 1];
+	int firstRow = 2 * row;
+	int lastRow = min(firstRow + 2, sourceRows);
+	PyramidCell* cells = pyramid->cells[level] + (size_t)row * pyramid->columns[level];
+	
+	for (int column = 0; column < pyramid->columns[level]; column++)
+	{
+		int firstColumn = 2 * column;
+		int lastColumn = min(firstColumn + 2, sourceColumns);
+		
+		float minAngle = INFINITY;
+		float maxAngle = -INFINITY;
+		double angleSum = 0;
+		double distanceSum = 0;
+		int64_t points = 0;
+		
+		for (int i = firstRow; i < lastRow; i++)
+		{
+			for (int j = firstColumn; j < lastColumn; j++)
+			{
+				if (level == 1)
+				{
+					float angle = results.angle(i, j);
+					minAngle = min(minAngle, angle);
+					maxAngle = max(maxAngle, angle);
+					angleSum += angle;
+					distanceSum += results.distance(i, j);
+					points++;
+				}
+				else
+				{
+					//each cell below stands for a different number of points at the edges, so its means are weighted by them
+					const PyramidCell& source = pyramid->cells[level - 1][(size_t)i * sourceColumns + j];
+					int scale = 1 << (level - 1);
+					int64_t sourcePoints = (int64_t)coveredPoints(pyramid->rows[0], scale, i) * coveredPoints(pyramid->columns[0], scale, j);
+					
+					minAngle = min(minAngle, source.minAngle);
+					maxAngle = max(maxAngle, source.maxAngle);
+					angleSum += (double)source.meanAngle * sourcePoints;
+					distanceSum += (double)source.meanDistance * sourcePoints;
+					points += sourcePoints;
+				}
+			}
+		}
+		
+		cells[column].minAngle = minAngle;
+		cells[column].maxAngle = maxAngle;
+		cells[column].meanAngle = (float)(angleSum / points);
+		cells[column].meanDistance = (float)(distanceSum / points);
+	}
+}
+
+void addPyramidRow(Pyramid* pyramid, const ResultGrid& results, int row, bool streamingStores)
+{
+#ifdef __SSE2__
+	//the thread that builds the cells may not be this one, so this row's streaming stores must be visible before it is counted
+	if (streamingStores)
+		_mm_sfence();
+#else
+	(void)streamingStores;
+#endif
+	
+	//the count is acquire-release, so the thread that completes a row of cells sees every row it is made from
+	for (int level = 1; level <= pyramid->levels; level++)
+	{
+		int cellRow = row / 2;
+		int sourceRows = min(2, pyramid->rows[level - 1] - 2 * cellRow);
+		
+		if (pyramid->rowsDone[level][cellRow].fetch_add(1, memory_order_acq_rel) + 1 != sourceRows)
+			return;
+		
+		buildPyramidRow(pyramid, results, level, cellRow);
+		row = cellRow;
+	}
+}
+
+//byte offset of a level of the pyramid in a results file - the pyramid starts at the first page boundary after the
+//planes, and its levels follow one another from level 1 upwards, each a row-major array of cells with no padding
+uint64_t pyramidLevelOffset(const GridFileHeader& header, int level)
+{
+	uint64_t offset = header.dataOffset + (uint64_t)header.planes * header.width * header.height * sizeof(float);
+	offset = (offset + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE;
+	
+	uint64_t rows = header.height;
+	uint64_t columns = header.width;
+	
+	for (int l = 1; l < level; l++)
+	{
+		rows = (rows + 1) / 2;
+		columns = (columns + 1) / 2;
+		offset += rows * columns * sizeof(PyramidCell);
+	}
+	
+	return offset;
+}
+
+void previewResults(void)
+{
+	double start = wallTime();
+	
+	int fd = open(options.previewPath.c_str(), O_RDONLY);
+	GridFileHeader header;
+	
+	if (fd == -1 || pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, GRID_FILE_MAGIC, 4) != 0
+		|| header.version != GRID_FILE_VERSION || header.planes != 2)
+	{
+		cout << "Error! " << options.previewPath << " is not a binary results file." << endl;
+		exit(1);
+	}
+	
+	if (header.pyramidLevels == 0)
+	{
+		cout << "Error! " << options.previewPath << " has no pyramid (save results with --pyramid to build one)." << endl;
+		exit(1);
+	}
+	
+	//without a level to read, pick the coarsest that still has enough cells to be worth looking at
+	int level = options.previewLevel;
+	uint64_t rows = header.height;
+	uint64_t columns = header.width;
+	
+	if (level == 0)
+	{
+		level = 1;
+		while (level < (int)header.pyramidLevels && ((rows + 3) / 4) * ((columns + 3) / 4) >= PREVIEW_CELLS)
+		{
+			rows = (rows + 1) / 2;
+			columns = (columns + 1) / 2;
+			level++;
+		}
+	}
+	
+	if (level > (int)header.pyramidLevels)
+	{
+		cout << "Error! " << options.previewPath << " only has " << header.pyramidLevels << " pyramid levels." << endl;
+		exit(1);
+	}
+	
+	rows = header.height;
+	columns = header.width;
+	for (int l = 0; l < level; l++)
+	{
+		rows = (rows + 1) / 2;
+		columns = (columns + 1) / 2;
+	}
+	
+	//only this one level is read - a few kilobytes, against the hundreds of megabytes of the planes themselves
+	vector<PyramidCell> cells(rows * columns);
+	size_t levelBytes = cells.size() * sizeof(PyramidCell);
+	
+	if (pread(fd, &cells[0], levelBytes, pyramidLevelOffset(header, level)) != (ssize_t)levelBytes)
+	{
+		cout << "Error! Could not read level " << level << " of the pyramid in " << options.previewPath << "." << endl;
+		exit(1);
+	}
+	
+	close(fd);
+	
+	float minAngle = INFINITY;
+	float maxAngle = -INFINITY;
+	double angleSum = 0;
+	double distanceSum = 0;
+	int scale = 1 << level;
+	
+	for (size_t r = 0; r < rows; r++)
+	{
+		for (size_t c = 0; c < columns; c++)
+		{
+			const PyramidCell& cell = cells[r * columns + c];
+			minAngle = min(minAngle, cell.minAngle);
+			maxAngle = max(maxAngle, cell.maxAngle);
+			double cellPoints = (double)coveredPoints(header.height, scale, r) * coveredPoints(header.width, scale, c);
+			angleSum += cell.meanAngle * cellPoints;
+			distanceSum += cell.meanDistance * cellPoints;
+		}
+	}
+	
+	double planeMegabytes = (double)header.height * header.width * sizeof(float) * 2 / (1024 * 1024);
+	
+	cout << "Read level " << level << " of " << header.pyramidLevels << " (" << rows << " x " << columns << " cells, "
+		<< (levelBytes / 1024.0) << "KB) of " << options.previewPath << " in " << ((wallTime() - start) * 1e3) << " ms, instead of "
+		<< planeMegabytes << "MB of results.\n";
+	cout << "Angles range from " << minAngle << " to " << maxAngle << " degrees, with a mean of "
+		<< (angleSum / ((double)header.height * header.width)) << " degrees, and the distances add up to " << distanceSum << ".\n";
+}
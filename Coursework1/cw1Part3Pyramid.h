@@ -0,0 +1,43 @@
+//pyramid - coarser and coarser summaries of the results, built as the rows of results are completed
+#ifndef CW1PART3PYRAMID_H
+#define CW1PART3PYRAMID_H
+
+#include "cw1Part3.h"
+
+//number of cells a preview level should have at least, when --preview does not say which level to read
+#define PREVIEW_CELLS 1024
+
+//one cell of a level of the results pyramid - level L reduces each 2^L x 2^L square of points to a single cell
+//(smaller at the bottom and right edges, where the grid runs out)
+//means are kept rather than sums, as a float sum over the millions of points under an upper level cell loses precision
+struct PyramidCell
+{
+	float minAngle;
+	float maxAngle;
+	float meanAngle;
+	float meanDistance;
+};
+
+//pyramid of results built while the results themselves are calculated - level 0 is the grid itself, so it has no cells
+//rowsDone counts, for each row of cells in a level, how many of the rows it is made from (in the level below) are
+//complete, so whichever thread completes the last of them builds the row of cells while the rows below are still in cache
+struct Pyramid
+{
+	int levels;
+	vector<int> rows;
+	vector<int> columns;
+	vector<PyramidCell*> cells;
+	vector<atomic<int>*> rowsDone;
+};
+
+//pyramid of results built by the kernels as they go - main() sets activePyramid before processing if one was asked for
+extern Pyramid* activePyramid;
+
+void setupPyramid(Pyramid& pyramid, int height, int width, int levels); //sizes and allocates a pyramid of up to the given number of levels
+void resetPyramid(Pyramid& pyramid); //clears the row counts, so the pyramid is built again by the next run
+void deletePyramid(Pyramid& pyramid); //frees a pyramid's levels
+void addPyramidRow(Pyramid* pyramid, const ResultGrid& results, int row, bool streamingStores); //counts a row of results as complete, building any pyramid rows it completes
+uint64_t pyramidLevelOffset(const GridFileHeader& header, int level); //byte offset of a level of the pyramid in a results file
+void previewResults(void); //reads one level of the pyramid in options.previewPath and summarises it
+
+#endif
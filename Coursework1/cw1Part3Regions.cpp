@@ -0,0 +1,341 @@
+//regions - a lock-free union-find over the grid, built by threads each labelling a band of rows and then joining the bands
+#include "cw1Part3Regions.h"
+
+//state shared by the threads labelling steep regions
+//parent holds a union-find forest over every point (linear index row * width + column), or -1 for points whose segment
+//is not steep - once the forest is complete, each root's entry is replaced by -(region id + 2)
+//indices, ids and the entries themselves are all 64-bit, as a grid of 2^31 points or more would overflow an int
+struct LabelData
+{
+	const ResultGrid* results;
+	atomic<int64_t>* parent;
+	pthread_barrier_t barrier;
+	
+	//number of roots found in each thread's band of rows, used to number the regions without any thread waiting on another
+	vector<int64_t> bandRoots;
+	
+	//statistics of each region, indexed by region id - filled in by every thread at once, a run of points at a time
+	//(apart from the first row, which is that of the region's root and is set by the thread that numbers it)
+	int64_t numRegions;
+	int* minRows;
+	atomic<int64_t>* sizes;
+	atomic<int>* minColumns;
+	atomic<int>* maxRows;
+	atomic<int>* maxColumns;
+};
+
+//data passed to each labelling thread - the band of rows it labels
+struct LabelThreadData
+{
+	LabelData* shared;
+	int index;
+	int firstRow;
+	int numRows;
+};
+
+//follows parent links from point i to the root of its tree, halving the path as it goes
+//every change only ever points an entry further up its own tree, so no other thread's view of the forest can be broken
+static int64_t findRoot(atomic<int64_t>* parent, int64_t i)
+{
+	while (true)
+	{
+		int64_t up = parent[i].load(memory_order_relaxed);
+		if (up == i)
+			return i;
+		
+		int64_t grandparent = parent[up].load(memory_order_relaxed);
+		if (grandparent != up)
+			parent[i].compare_exchange_weak(up, grandparent, memory_order_relaxed);
+		
+		i = grandparent;
+	}
+}
+
+//joins the trees of points a and b without locking - the root with the higher index is pointed at the other, and only
+//if it is still a root, so two threads joining the same trees at once cannot make a cycle
+static void uniteRegions(atomic<int64_t>* parent, int64_t a, int64_t b)
+{
+	while (true)
+	{
+		a = findRoot(parent, a);
+		b = findRoot(parent, b);
+		
+		if (a == b)
+			return;
+		
+		if (a < b)
+			swap(a, b);
+		
+		int64_t expected = a;
+		if (parent[a].compare_exchange_strong(expected, b, memory_order_acq_rel))
+			return;
+	}
+}
+
+static inline void atomicMin(atomic<int>& value, int candidate)
+{
+	int current = value.load(memory_order_relaxed);
+	while (candidate < current && !value.compare_exchange_weak(current, candidate, memory_order_relaxed))
+		;
+}
+
+static inline void atomicMax(atomic<int>& value, int candidate)
+{
+	int current = value.load(memory_order_relaxed);
+	while (candidate > current && !value.compare_exchange_weak(current, candidate, memory_order_relaxed))
+		;
+}
+
+//adds a run of points in one row, all in the same region, to that region's statistics
+static void addRegionRun(LabelData* shared, int64_t id, int row, int firstColumn, int lastColumn)
+{
+	shared->sizes[id].fetch_add(lastColumn - firstColumn + 1, memory_order_relaxed);
+	atomicMin(shared->minColumns[id], firstColumn);
+	atomicMax(shared->maxColumns[id], lastColumn);
+	atomicMax(shared->maxRows[id], row);
+}
+
+static void* labelBand(void* data)
+{
+	LabelThreadData* threadData = (LabelThreadData*)data;
+	LabelData* shared = threadData->shared;
+	atomic<int64_t>* parent = shared->parent;
+	const ResultGrid& results = *shared->results;
+	int width = options.arrayWidth;
+	int firstRow = threadData->firstRow;
+	int endRow = firstRow + threadData->numRows;
+	
+	//label the band on its own, joining each steep point to the steep points before it and above it in the band
+	//the last segment of a row wraps around to the first point, so the first and last points of a row are neighbours too
+	for (int row = firstRow; row < endRow; row++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			int64_t i = (int64_t)row * width + j;
+			bool steep = fabsf(results.angle(row, j)) > options.regionThreshold;
+			parent[i].store(steep ? i : -1, memory_order_relaxed);
+			
+			if (!steep)
+				continue;
+			
+			if (j > 0 && parent[i - 1].load(memory_order_relaxed) != -1)
+				uniteRegions(parent, i, i - 1);
+			if (j == width - 1 && parent[i - j].load(memory_order_relaxed) != -1)
+				uniteRegions(parent, i, i - j);
+			if (row > firstRow && parent[i - width].load(memory_order_relaxed) != -1)
+				uniteRegions(parent, i, i - width);
+		}
+	}
+	
+	pthread_barrier_wait(&shared->barrier);
+	
+	//join the first row of the band to the last row of the band above, which another thread may be joining to at the same time
+	if (firstRow > 0)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			int64_t i = (int64_t)firstRow * width + j;
+			if (parent[i].load(memory_order_relaxed) != -1 && parent[i - width].load(memory_order_relaxed) != -1)
+				uniteRegions(parent, i, i - width);
+		}
+	}
+	
+	pthread_barrier_wait(&shared->barrier);
+	
+	//no more joins happen from here, so every point can be pointed straight at its root
+	//each root is the first point of its region, as trees are always joined under the lower index
+	int64_t roots = 0;
+	for (int64_t i = (int64_t)firstRow * width; i < (int64_t)endRow * width; i++)
+	{
+		if (parent[i].load(memory_order_relaxed) == -1)
+			continue;
+		
+		int64_t root = findRoot(parent, i);
+		parent[i].store(root, memory_order_relaxed);
+		
+		if (root == i)
+			roots++;
+	}
+	
+	shared->bandRoots[threadData->index] = roots;
+	
+	//one thread allocates the statistics once every band's roots have been counted
+	if (pthread_barrier_wait(&shared->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+	{
+		shared->numRegions = 0;
+		for (size_t b = 0; b < shared->bandRoots.size(); b++)
+			shared->numRegions += shared->bandRoots[b];
+		
+		shared->minRows = new int[shared->numRegions];
+		shared->sizes = new atomic<int64_t>[shared->numRegions];
+		shared->minColumns = new atomic<int>[shared->numRegions];
+		shared->maxRows = new atomic<int>[shared->numRegions];
+		shared->maxColumns = new atomic<int>[shared->numRegions];
+	}
+	
+	pthread_barrier_wait(&shared->barrier);
+	
+	//number the band's regions after those of every band above it, in the order their roots appear
+	int64_t id = 0;
+	for (int b = 0; b < threadData->index; b++)
+		id += shared->bandRoots[b];
+	
+	for (int64_t i = (int64_t)firstRow * width; i < (int64_t)endRow * width; i++)
+	{
+		if (parent[i].load(memory_order_relaxed) != i)
+			continue;
+		
+		shared->minRows[id] = (int)(i / width);
+		shared->sizes[id].store(0, memory_order_relaxed);
+		shared->minColumns[id].store(width, memory_order_relaxed);
+		shared->maxRows[id].store((int)(i / width), memory_order_relaxed);
+		shared->maxColumns[id].store(-1, memory_order_relaxed);
+		parent[i].store(-(id + 2), memory_order_relaxed);
+		id++;
+	}
+	
+	pthread_barrier_wait(&shared->barrier);
+	
+	//add up the size and extent of each region, a run of neighbouring points in the same region at a time
+	for (int row = firstRow; row < endRow; row++)
+	{
+		int64_t runId = -1;
+		int runStart = 0;
+		
+		for (int j = 0; j <= width; j++)
+		{
+			int64_t pointId = -1;
+			
+			if (j < width)
+			{
+				int64_t value = parent[(int64_t)row * width + j].load(memory_order_relaxed);
+				if (value != -1)
+					pointId = -((value <= -2 ? value : parent[value].load(memory_order_relaxed)) + 2);
+			}
+			
+			if (pointId != runId)
+			{
+				if (runId != -1)
+					addRegionRun(shared, runId, row, runStart, j - 1);
+				
+				runId = pointId;
+				runStart = j;
+			}
+		}
+	}
+	
+	return NULL;
+}
+
+//labels the steep regions of the results with the given number of threads, returning the time taken
+static double labelSteepRegions(const ResultGrid& results, atomic<int64_t>* parent, int numThreads, vector<SteepRegion>& regions)
+{
+	double start = wallTime();
+	
+	LabelData shared;
+	shared.results = &results;
+	shared.parent = parent;
+	shared.bandRoots.assign(numThreads, 0);
+	pthread_barrier_init(&shared.barrier, NULL, numThreads);
+	
+	LabelThreadData* data = new LabelThreadData[numThreads];
+	pthread_t* threads = new pthread_t[numThreads];
+	
+	for (int t = 0; t < numThreads; t++)
+	{
+		data[t].shared = &shared;
+		data[t].index = t;
+		data[t].firstRow = (int)((int64_t)options.arrayHeight * t / numThreads);
+		data[t].numRows = (int)((int64_t)options.arrayHeight * (t + 1) / numThreads) - data[t].firstRow;
+		pthread_create(&threads[t], NULL, labelBand, (void*)&data[t]);
+	}
+	
+	for (int t = 0; t < numThreads; t++)
+		pthread_join(threads[t], NULL);
+	
+	regions.resize(shared.numRegions);
+	
+	for (int64_t id = 0; id < shared.numRegions; id++)
+	{
+		regions[id].id = id;
+		regions[id].size = shared.sizes[id].load(memory_order_relaxed);
+		regions[id].minRow = shared.minRows[id];
+		regions[id].minColumn = shared.minColumns[id].load(memory_order_relaxed);
+		regions[id].maxRow = shared.maxRows[id].load(memory_order_relaxed);
+		regions[id].maxColumn = shared.maxColumns[id].load(memory_order_relaxed);
+	}
+	
+	double time = wallTime() - start;
+	
+	pthread_barrier_destroy(&shared.barrier);
+	delete[] shared.minRows;
+	delete[] shared.sizes;
+	delete[] shared.minColumns;
+	delete[] shared.maxRows;
+	delete[] shared.maxColumns;
+	delete[] data;
+	delete[] threads;
+	
+	return time;
+}
+
+void findSteepRegions(const ResultGrid& results)
+{
+	atomic<int64_t>* parent = new atomic<int64_t>[(size_t)options.arrayHeight * options.arrayWidth];
+	vector<SteepRegion> regions;
+	
+	int maxThreads = min(min(options.numThreads, options.arrayHeight), MAX_LABEL_THREADS);
+	double points = (double)options.arrayHeight * options.arrayWidth;
+	
+	cout << "Labelling regions steeper than " << options.regionThreshold << " degrees:\nThreads | seconds | million points/s | regions\n";
+	
+	//every thread count must find exactly the same regions, so the count is shown alongside the time
+	for (int numThreads = 1; ; numThreads = min(2 * numThreads, maxThreads))
+	{
+		double time = labelSteepRegions(results, parent, numThreads, regions);
+		cout << numThreads << " | " << time << " | " << (points / time / 1e6) << " | " << regions.size() << "\n";
+		
+		if (numThreads == maxThreads)
+			break;
+	}
+	
+	int64_t steepPoints = 0;
+	for (size_t r = 0; r < regions.size(); r++)
+		steepPoints += regions[r].size;
+	
+	cout << regions.size() << " regions hold the " << steepPoints << " segments steeper than " << options.regionThreshold << " degrees.\n";
+	
+	//list the largest regions, keeping grid order between regions of the same size
+	vector<SteepRegion> largest(regions);
+	size_t listed = min(largest.size(), (size_t)REGIONS_LISTED);
+	partial_sort(largest.begin(), largest.begin() + listed, largest.end(), [](const SteepRegion& a, const SteepRegion& b)
+	{
+		return a.size != b.size ? a.size > b.size : a.id < b.id;
+	});
+	
+	if (listed > 0)
+	{
+		cout << "Largest regions:\nRegion | segments | rows | columns\n";
+		
+		for (size_t r = 0; r < listed; r++)
+			cout << largest[r].id << " | " << largest[r].size << " | " << largest[r].minRow << "-" << largest[r].maxRow << " | "
+				<< largest[r].minColumn << "-" << largest[r].maxColumn << "\n";
+	}
+	
+	if (!options.regionsPath.empty())
+	{
+		ofstream file(options.regionsPath.c_str(), ios::trunc);
+		
+		//one region on each line - its id, size and bounding box (first row, first column, last row, last column)
+		for (size_t r = 0; r < regions.size() && file.is_open(); r++)
+			file << regions[r].id << " " << regions[r].size << " " << regions[r].minRow << " " << regions[r].minColumn << " "
+				<< regions[r].maxRow << " " << regions[r].maxColumn << "\n";
+		
+		if (file.is_open() && file.good())
+			cout << "Regions written to " << options.regionsPath << ".\n";
+		else
+			cout << "Error! Could not write regions to " << options.regionsPath << "." << endl;
+	}
+	
+	delete[] parent;
+}
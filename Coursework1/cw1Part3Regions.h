@@ -0,0 +1,28 @@
+//regions - connected regions of segments steeper than --regions, labelled once the results are complete
+#ifndef CW1PART3REGIONS_H
+#define CW1PART3REGIONS_H
+
+#include "cw1Part3.h"
+
+//largest number of threads steep regions are labelled with - thread counts double from 1 up to this or --threads
+#define MAX_LABEL_THREADS 64
+
+//number of regions listed on the screen, largest first (every region is written to the --regions-file)
+#define REGIONS_LISTED 10
+
+//size and bounding box of one connected region of steep segments
+//regions are numbered in the order their first points appear in the grid, so minRow is always the row of the first point
+//a region that crosses the edge of the grid (a row's last segment wraps around to its first point) spans every column
+struct SteepRegion
+{
+	int64_t id;
+	int64_t size;
+	int minRow;
+	int minColumn;
+	int maxRow;
+	int maxColumn;
+};
+
+void findSteepRegions(const ResultGrid& results); //labels connected steep regions with each thread count in turn and reports them
+
+#endif
@@ -0,0 +1,421 @@
+//roofline - read, write, copy and multiply-add loops at each level of the memory hierarchy, then every kernel variant
+#include "cw1Part3Roofline.h"
+
+//tests run by the roofline benchmark - the first four measure the host, the rest run a kernel variant over a grid
+enum RooflineTest
+{
+	ROOFLINE_READ,
+	ROOFLINE_WRITE,
+	ROOFLINE_COPY,
+	ROOFLINE_FMA,
+	ROOFLINE_PART1,
+	ROOFLINE_PART2,
+	ROOFLINE_KERNEL
+};
+
+//a cache line of floats, which arithmetic works on element by element
+typedef float RooflineVector __attribute__((vector_size(ROOFLINE_VECTOR_FLOATS * sizeof(float))));
+
+//data passed to each thread of a roofline measurement
+struct alignas(CACHE_LINE_SIZE) RooflineThreadData
+{
+	RooflineTest test;
+	int passes;
+	
+	//bandwidth tests: the thread's own buffer, which it touches first so that it is local to the thread
+	float* buffer;
+	size_t floats;
+	
+	//kernel tests: the thread's rows of the grid and the kernel run over them
+	ThreadData* threadData;
+	
+	//every thread waits here with the main thread, so creating the threads is not timed
+	pthread_barrier_t* start;
+	
+	//written at the end so the compiler cannot drop the loops whose results are otherwise unused
+	float sink;
+};
+
+//the loop from cw1Part1, run over a range of rows - each row is one pass along heights with the wrap around at the end
+static void processRowsPart1(float** mainArray, float** distanceArray, float** angleArray, int firstRow, int numRows)
+{
+	int width = options.arrayWidth;
+	
+	for (int i = firstRow; i < firstRow + numRows; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			int nextColumn = j+1;
+			
+			if (j == width - 1)
+				nextColumn = 0;
+			
+			float verticalDist = mainArray[i][nextColumn] - mainArray[i][j];
+			float hypotenuse = sqrt(pow(verticalDist, 2) + pow(options.pointSpacing, 2));
+			
+			distanceArray[i][j] = hypotenuse;
+			angleArray[i][j] = DEGREES_PER_RADIAN * asin(verticalDist / hypotenuse);
+		}
+	}
+}
+
+static void* runRooflineTest(void* data)
+{
+	RooflineThreadData* testData = (RooflineThreadData*)data;
+	RooflineVector* vectors = (RooflineVector*)testData->buffer;
+	size_t numVectors = testData->floats / ROOFLINE_VECTOR_FLOATS;
+	RooflineVector accumulators[ROOFLINE_VECTORS];
+	float sink = 0;
+	
+	pthread_barrier_wait(testData->start);
+	
+	for (int pass = 0; pass < testData->passes; pass++)
+	{
+		switch (testData->test)
+		{
+			case ROOFLINE_READ:
+				for (int k = 0; k < ROOFLINE_VECTORS; k++)
+					accumulators[k] = vectors[k];
+				
+				//the accumulator loops are unrolled so the accumulators stay in registers (the pragma does not expand macros,
+				//so its count is ROOFLINE_VECTORS written out)
+				for (size_t i = ROOFLINE_VECTORS; i < numVectors; i += ROOFLINE_VECTORS)
+					#pragma GCC unroll 8
+					for (int k = 0; k < ROOFLINE_VECTORS; k++)
+						accumulators[k] += vectors[i + k];
+				
+				for (int k = 0; k < ROOFLINE_VECTORS; k++)
+					sink += accumulators[k][0];
+				break;
+			case ROOFLINE_WRITE:
+			{
+				RooflineVector value = (float)pass - (RooflineVector){};
+				
+				for (size_t i = 0; i < numVectors; i++)
+					vectors[i] = value;
+				break;
+			}
+			case ROOFLINE_COPY:
+				//alternate the direction, so every pass reads what the last one wrote
+				if (pass % 2 == 0)
+					memcpy(vectors + numVectors / 2, vectors, numVectors / 2 * sizeof(RooflineVector));
+				else
+					memcpy(vectors, vectors + numVectors / 2, numVectors / 2 * sizeof(RooflineVector));
+				break;
+			case ROOFLINE_FMA:
+				for (int k = 0; k < ROOFLINE_VECTORS; k++)
+					accumulators[k] = (float)k - (RooflineVector){};
+				
+				//each accumulator heads towards a fixed point, so the values stay normal however long this runs
+				for (int i = 0; i < ROOFLINE_FMA_ITERATIONS; i++)
+					#pragma GCC unroll 8
+					for (int k = 0; k < ROOFLINE_VECTORS; k++)
+						accumulators[k] = accumulators[k] * 0.999f + 0.001f;
+				
+				for (int k = 0; k < ROOFLINE_VECTORS; k++)
+					sink += accumulators[k][0];
+				break;
+			case ROOFLINE_PART1:
+				processRowsPart1(testData->threadData->mainArray, testData->threadData->results.distanceArray, testData->threadData->results.angleArray,
+					testData->threadData->currentRow, testData->threadData->rowsToProcess);
+				break;
+			case ROOFLINE_PART2:
+				//cw1Part2 handed the rows to processRows() a few at a time
+				for (int row = 0; row < testData->threadData->rowsToProcess; row += PART2_ROWS_TO_PROCESS)
+					processRowsPart1(testData->threadData->mainArray, testData->threadData->results.distanceArray, testData->threadData->results.angleArray,
+						testData->threadData->currentRow + row, min(PART2_ROWS_TO_PROCESS, testData->threadData->rowsToProcess - row));
+				break;
+			case ROOFLINE_KERNEL:
+				testData->threadData->kernel(testData->threadData);
+				break;
+		}
+	}
+	
+	testData->sink = sink;
+	return NULL;
+}
+
+//runs a test on numThreads threads and returns the fastest wall-clock time of ROOFLINE_REPEATS runs
+static double timeRooflineTest(RooflineThreadData* data, int numThreads)
+{
+	pthread_t* threads = new pthread_t[numThreads];
+	pthread_barrier_t start;
+	double bestTime = 0;
+	
+	for (int repeat = 0; repeat < ROOFLINE_REPEATS; repeat++)
+	{
+		pthread_barrier_init(&start, NULL, numThreads + 1);
+		
+		for (int i = 0; i < numThreads; i++)
+		{
+			data[i].start = &start;
+			pthread_create(&threads[i], NULL, runRooflineTest, (void*)&data[i]);
+		}
+		
+		pthread_barrier_wait(&start);
+		double startTime = wallTime();
+		
+		for (int i = 0; i < numThreads; i++)
+			pthread_join(threads[i], NULL);
+		
+		double runTime = wallTime() - startTime;
+		pthread_barrier_destroy(&start);
+		
+		if (repeat == 0 || runTime < bestTime)
+			bestTime = runTime;
+	}
+	
+	delete[] threads;
+	return bestTime;
+}
+
+//what the host can do with a given working set and number of threads
+struct RooflineCeilings
+{
+	size_t bytesPerThread;
+	double readBandwidth;
+	double writeBandwidth;
+	double copyBandwidth;
+};
+
+//measures read, write and copy bandwidth in bytes per second with each thread working on its own buffer of the given size
+static RooflineCeilings measureBandwidth(size_t bytesPerThread, int numThreads)
+{
+	RooflineCeilings ceilings;
+	RooflineThreadData* data = new RooflineThreadData[numThreads];
+	
+	//whole groups of accumulators' worth of floats, and an even number of them so a copy is between two halves of the same size
+	size_t groupFloats = 2 * ROOFLINE_VECTORS * ROOFLINE_VECTOR_FLOATS;
+	size_t floats = max(groupFloats, bytesPerThread / sizeof(float) / groupFloats * groupFloats);
+	size_t bytes = floats * sizeof(float);
+	int passes = (int)max((size_t)1, ROOFLINE_BYTES_PER_TRIAL / (bytes * numThreads));
+	
+	ceilings.bytesPerThread = bytes;
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		data[i].buffer = (float*)aligned_alloc(CACHE_LINE_SIZE, bytes);
+		data[i].floats = floats;
+		data[i].passes = 1;
+		data[i].test = ROOFLINE_WRITE;
+	}
+	
+	//one untimed write first, so every page has been faulted in by the thread that uses it
+	timeRooflineTest(data, numThreads);
+	
+	RooflineTest tests[3] = { ROOFLINE_READ, ROOFLINE_WRITE, ROOFLINE_COPY };
+	double* results[3] = { &ceilings.readBandwidth, &ceilings.writeBandwidth, &ceilings.copyBandwidth };
+	
+	for (int t = 0; t < 3; t++)
+	{
+		for (int i = 0; i < numThreads; i++)
+		{
+			data[i].test = tests[t];
+			data[i].passes = passes;
+		}
+		
+		//a copy reads half the buffer and writes the other half, so it moves as many bytes as a read or a write does
+		*results[t] = (double)bytes * numThreads * passes / timeRooflineTest(data, numThreads);
+	}
+	
+	for (int i = 0; i < numThreads; i++)
+		free(data[i].buffer);
+	delete[] data;
+	
+	return ceilings;
+}
+
+//measures peak float throughput in operations per second, counting each multiply-add as two
+static double measureFloatThroughput(int numThreads)
+{
+	RooflineThreadData* data = new RooflineThreadData[numThreads];
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		data[i].test = ROOFLINE_FMA;
+		data[i].passes = 1;
+	}
+	
+	double flops = 2.0 * ROOFLINE_VECTORS * ROOFLINE_VECTOR_FLOATS * ROOFLINE_FMA_ITERATIONS * numThreads / timeRooflineTest(data, numThreads);
+	
+	delete[] data;
+	return flops;
+}
+
+//cache sizes in bytes, with common sizes assumed for any the C library cannot report
+static void cacheSizes(size_t& l1, size_t& l2, size_t& l3)
+{
+	long size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	l1 = size > 0 ? size : 32 * 1024;
+	size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	l2 = size > 0 ? size : 1024 * 1024;
+	size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	l3 = size > 0 ? size : 32 * 1024 * 1024;
+}
+
+void runRoofline(void)
+{
+	int cpus = availableCpuCount();
+	int maxThreads = max(1, min(options.numThreads, cpus));
+	
+	size_t l1, l2, l3;
+	cacheSizes(l1, l2, l3);
+	
+	//each level's working set is half of the cache, so it stays resident - L1 and L2 are per core, so each thread gets that much,
+	//while the L3 is shared out between the threads - and the DRAM working set is twice the L3, so at most half of it is cached
+	const char* levelNames[4] = { "L1", "L2", "L3", "DRAM" };
+	size_t levelBytes[4] = { l1 / 2, l2 / 2, l3 / 2, max((size_t)ROOFLINE_DRAM_BYTES, 2 * l3) };
+	bool levelShared[4] = { false, false, true, true };
+	
+	//the serial variants are compared with what one thread can do, the threaded ones with what every thread can
+	int threadCounts[2] = { 1, maxThreads };
+	int numThreadCounts = maxThreads > 1 ? 2 : 1;
+	
+	cout << "Measuring the roofline with " << maxThreads << " threads (" << cpus << " usable CPUs), L1d " << (l1 / 1024) << "KB, L2 " << (l2 / 1024)
+		<< "KB, L3 " << (l3 / 1024) << "KB.\n";
+	cout << "Level | threads | KB per thread | read GB/s | write GB/s | copy GB/s\n";
+	
+	RooflineCeilings ceilings[2][4];
+	double peakFlops[2];
+	
+	for (int t = 0; t < 2; t++)
+	{
+		if (t >= numThreadCounts)
+		{
+			for (int level = 0; level < 4; level++)
+				ceilings[t][level] = ceilings[0][level];
+			peakFlops[t] = peakFlops[0];
+			continue;
+		}
+		
+		for (int level = 0; level < 4; level++)
+		{
+			size_t bytesPerThread = levelShared[level] ? levelBytes[level] / threadCounts[t] : levelBytes[level];
+			ceilings[t][level] = measureBandwidth(bytesPerThread, threadCounts[t]);
+			
+			cout << levelNames[level] << " | " << threadCounts[t] << " | " << (ceilings[t][level].bytesPerThread / 1024) << " | "
+				<< (ceilings[t][level].readBandwidth / 1e9) << " | " << (ceilings[t][level].writeBandwidth / 1e9) << " | " << (ceilings[t][level].copyBandwidth / 1e9) << "\n";
+		}
+		
+		peakFlops[t] = measureFloatThroughput(threadCounts[t]);
+	}
+	
+	for (int t = 0; t < numThreadCounts; t++)
+		cout << "Peak float throughput with " << threadCounts[t] << " threads: " << (peakFlops[t] / 1e9) << " GFLOP/s.\n";
+	
+	cout << "Each point reads " << SLOPE_BYTES_READ << " bytes, writes " << SLOPE_BYTES_WRITTEN << " and is counted as " << SLOPE_FLOPS
+		<< " floating point operations (" << ((double)SLOPE_FLOPS / (SLOPE_BYTES_READ + SLOPE_BYTES_WRITTEN)) << " per byte).\n";
+	
+	//one grid big enough for the largest working set - every row of heights and results takes this many bytes
+	size_t bytesPerRow = (size_t)(SLOPE_BYTES_READ + SLOPE_BYTES_WRITTEN) * floatRowStride;
+	int maxRows = 1;
+	for (int t = 0; t < numThreadCounts; t++)
+		for (int level = 0; level < 4; level++)
+			maxRows = max(maxRows, max(1, (int)(ceilings[t][level].bytesPerThread / bytesPerRow)) * threadCounts[t]);
+	
+	//generate heights in the same format as generateRandomNumberFile, so the lookup kernel can use its table
+	options.arrayHeight = maxRows;
+	float** mainArray = setup2DArrayOnHeap<float>();
+	srand(time(NULL));
+	
+	for (int i = 0; i < options.arrayHeight; i++)
+	{
+		for (int j = 0; j < options.arrayWidth; j++)
+		{
+			int whole = rand() % 999 + 1;
+			int fraction = rand() % 999 + 1;
+			double scale = fraction < 10 ? 10 : (fraction < 100 ? 100 : 1000);
+			mainArray[i][j] = (float)((whole * scale + fraction) / scale);
+		}
+	}
+	
+	//the cw1Part1 and cw1Part2 loops only know separate distance and angle grids
+	ResultGrid planeResults = setupResultGrid(LAYOUT_PLANES);
+	ResultGrid results = options.layout == LAYOUT_PLANES ? planeResults : setupResultGrid(options.layout);
+	buildSlopeTable();
+	
+	bool specialised;
+	RowRangeKernel mathKernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialised);
+	
+	//the lookup kernel's table reads are not counted as traffic, as they depend on the heights
+	struct RooflineVariant
+	{
+		const char* name;
+		RooflineTest test;
+		RowRangeKernel kernel;
+		bool streamingStores;
+		bool threaded;
+	};
+	
+	RooflineVariant variants[] =
+	{
+		{ "serial (cw1Part1)", ROOFLINE_PART1, NULL, false, false },
+		{ "chunked (cw1Part2)", ROOFLINE_PART2, NULL, false, false },
+		{ "threaded math", ROOFLINE_KERNEL, mathKernel, false, true },
+		{ "threaded math, streaming stores", ROOFLINE_KERNEL, mathKernel, true, true },
+		{ "threaded lookup", ROOFLINE_KERNEL, processRowRangeLookup, false, true }
+	};
+	int numVariants = sizeof(variants) / sizeof(variants[0]);
+	
+	ThreadData* threadData = new ThreadData[maxThreads];
+	RooflineThreadData* data = new RooflineThreadData[maxThreads];
+	
+	cout << "Variant | level | threads | KB per thread | million points/s | GB/s | GFLOP/s | roof (million points/s) | bound | % of roof\n";
+	
+	for (int v = 0; v < numVariants; v++)
+	{
+		const RooflineVariant& variant = variants[v];
+		int t = variant.threaded ? numThreadCounts - 1 : 0;
+		int numThreads = threadCounts[t];
+		
+		for (int level = 0; level < 4; level++)
+		{
+			const RooflineCeilings& ceiling = ceilings[t][level];
+			int rowsPerThread = max(1, (int)(ceiling.bytesPerThread / bytesPerRow));
+			
+			//the kernels stop at options.arrayHeight, so it is set to the rows this working set uses
+			options.arrayHeight = rowsPerThread * numThreads;
+			
+			size_t points = (size_t)options.arrayHeight * options.arrayWidth;
+			int passes = (int)max((size_t)1, ROOFLINE_BYTES_PER_TRIAL / (points * (SLOPE_BYTES_READ + SLOPE_BYTES_WRITTEN)));
+			
+			for (int i = 0; i < numThreads; i++)
+			{
+				threadData[i].mainArray = mainArray;
+				threadData[i].results = variant.threaded ? results : planeResults;
+				threadData[i].currentRow = i * rowsPerThread;
+				threadData[i].rowsToProcess = rowsPerThread;
+				threadData[i].streamingStores = variant.streamingStores;
+				threadData[i].kernel = variant.kernel;
+				threadData[i].lookupFallbackRows = 0;
+				threadData[i].threadIndex = i;
+				threadData[i].traceBuffer = NULL;
+				
+				data[i].test = variant.test;
+				data[i].passes = passes;
+				data[i].threadData = &threadData[i];
+			}
+			
+			double pointsPerSecond = (double)points * passes / timeRooflineTest(data, numThreads);
+			
+			//the most points per second the reads, the writes, or all of the traffic at the rate a copy moves it could allow
+			double memoryRoof = min(ceiling.readBandwidth / SLOPE_BYTES_READ, ceiling.writeBandwidth / SLOPE_BYTES_WRITTEN);
+			memoryRoof = min(memoryRoof, ceiling.copyBandwidth / (SLOPE_BYTES_READ + SLOPE_BYTES_WRITTEN));
+			double computeRoof = peakFlops[t] / SLOPE_FLOPS;
+			double roof = min(memoryRoof, computeRoof);
+			
+			cout << variant.name << " | " << levelNames[level] << " | " << numThreads << " | " << (rowsPerThread * bytesPerRow / 1024) << " | " << (pointsPerSecond / 1e6) << " | "
+				<< (pointsPerSecond * (SLOPE_BYTES_READ + SLOPE_BYTES_WRITTEN) / 1e9) << " | " << (pointsPerSecond * SLOPE_FLOPS / 1e9) << " | " << (roof / 1e6) << " | "
+				<< (memoryRoof < computeRoof ? "memory" : "compute") << " | " << (100 * pointsPerSecond / roof) << "%\n";
+		}
+	}
+	
+	delete[] threadData;
+	delete[] data;
+	delete2DArray<float>(mainArray);
+	if (options.layout != LAYOUT_PLANES)
+		deleteResultGrid(results);
+	deleteResultGrid(planeResults);
+	delete[] slopeTable;
+	slopeTable = NULL;
+}
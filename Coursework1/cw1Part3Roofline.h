@@ -0,0 +1,34 @@
+//roofline - the host's bandwidth and float throughput, and how close each kernel variant comes to them
+#ifndef CW1PART3ROOFLINE_H
+#define CW1PART3ROOFLINE_H
+
+#include "cw1Part3.h"
+
+//total number of bytes each roofline measurement moves (repeating passes over smaller working sets to make it up),
+//and the number of times each measurement is repeated (the fastest is kept)
+#define ROOFLINE_BYTES_PER_TRIAL (256 * 1024 * 1024)
+#define ROOFLINE_REPEATS 3
+
+//smallest working set used for the DRAM measurements, in case the last level cache is unknown or very small
+#define ROOFLINE_DRAM_BYTES (256 * 1024 * 1024)
+
+//bandwidth and float throughput are measured a cache line of floats at a time (which the compiler splits into the widest
+//registers the target has), with enough independent accumulators to keep every vector unit busy despite the latency of each
+//addition or multiply-add, so the loops are limited by throughput alone
+#define ROOFLINE_VECTOR_FLOATS 16
+#define ROOFLINE_VECTORS 8
+#define ROOFLINE_FMA_ITERATIONS 20000000
+
+//traffic and arithmetic in one slope calculation: a height is read (its neighbour comes from the same or the next cache line)
+//and a distance and an angle are written, and the arithmetic is a subtraction, a multiply-add (counted as two), a square root,
+//a division, an arcsine and a multiply - counting each library call as one operation, so this understates the real work
+#define SLOPE_BYTES_READ 4
+#define SLOPE_BYTES_WRITTEN 8
+#define SLOPE_FLOPS 7
+
+//size of the chunks of rows processRows() was handed in cw1Part2
+#define PART2_ROWS_TO_PROCESS 7
+
+void runRoofline(void); //measures the host's bandwidth and float throughput, then how close each kernel variant comes to them
+
+#endif
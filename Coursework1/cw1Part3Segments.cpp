@@ -0,0 +1,193 @@
+//segments - each thread keeps its own heap and list of segments, and they are merged once the threads have finished
+#include "cw1Part3Segments.h"
+
+//collectors of every thread that has processed rows while segments were being picked out - guarded by collectorsLock,
+//which is only taken when a thread first asks for its collector and when main() merges them after the threads finish
+static vector<SegmentCollector*> segmentCollectors;
+static pthread_mutex_t collectorsLock = PTHREAD_MUTEX_INITIALIZER;
+static thread_local SegmentCollector* currentCollector = NULL;
+
+//collectors whose threads have finished, handed to the next thread that asks for one - guarded by collectorsLock
+//segments already in them are kept until the next merge, so nothing collected by a finished thread is lost
+static vector<SegmentCollector*> idleCollectors;
+
+//hands the calling thread's collector back when the thread exits, so short-lived pthread workers do not each add one
+struct CollectorRelease
+{
+	~CollectorRelease()
+	{
+		if (currentCollector == NULL)
+			return;
+		
+		pthread_mutex_lock(&collectorsLock);
+		idleCollectors.push_back(currentCollector);
+		pthread_mutex_unlock(&collectorsLock);
+		
+		currentCollector = NULL;
+	}
+};
+static thread_local CollectorRelease collectorRelease;
+
+//true if segment a is steeper than segment b - ties are broken by position, so the segments kept do not depend on
+//how the rows were shared out between threads
+static inline bool steeperSegment(const SlopeSegment& a, const SlopeSegment& b)
+{
+	float steepnessA = fabsf(a.angle);
+	float steepnessB = fabsf(b.angle);
+	
+	if (steepnessA != steepnessB)
+		return steepnessA > steepnessB;
+	
+	return a.row != b.row ? a.row < b.row : a.column < b.column;
+}
+
+//works out the steepness a segment must reach to be kept - anything steeper than the threshold, or steep enough to
+//get into a heap that is not yet full or to push out the least steep segment in a full one
+static void updateCutoff(SegmentCollector* collector)
+{
+	float heapCutoff;
+	
+	if (options.topSegments <= 0)
+		heapCutoff = INFINITY;
+	else if ((int)collector->steepest.size() < options.topSegments)
+		heapCutoff = -1;
+	else
+		heapCutoff = fabsf(collector->steepest.front().angle);
+	
+	collector->cutoff = options.steeperThan >= 0 ? min(heapCutoff, options.steeperThan) : heapCutoff;
+}
+
+SegmentCollector* segmentCollector(void)
+{
+	if (options.topSegments <= 0 && options.steeperThan < 0)
+		return NULL;
+	
+	if (currentCollector == NULL)
+	{
+		SegmentCollector* collector;
+		
+		pthread_mutex_lock(&collectorsLock);
+		
+		//touching the thread-local release object makes sure it is constructed, so that its destructor runs at thread exit
+		(void)&collectorRelease;
+		
+		if (!idleCollectors.empty())
+		{
+			collector = idleCollectors.back();
+			idleCollectors.pop_back();
+		}
+		else
+		{
+			collector = new SegmentCollector;
+			updateCutoff(collector);
+			segmentCollectors.push_back(collector);
+		}
+		
+		pthread_mutex_unlock(&collectorsLock);
+		
+		currentCollector = collector;
+	}
+	
+	return currentCollector;
+}
+
+//looks closely at a segment which has passed the collector's cutoff
+static void collectSegment(SegmentCollector* collector, int row, int column, float angle, float distance)
+{
+	SlopeSegment segment = { row, column, angle, distance };
+	float steepness = fabsf(angle);
+	
+	if (options.steeperThan >= 0 && steepness > options.steeperThan)
+		collector->hits.push_back(segment);
+	
+	if (options.topSegments > 0)
+	{
+		vector<SlopeSegment>& steepest = collector->steepest;
+		
+		if ((int)steepest.size() < options.topSegments)
+		{
+			steepest.push_back(segment);
+			push_heap(steepest.begin(), steepest.end(), steeperSegment);
+		}
+		else if (steeperSegment(segment, steepest.front()))
+		{
+			pop_heap(steepest.begin(), steepest.end(), steeperSegment);
+			steepest.back() = segment;
+			push_heap(steepest.begin(), steepest.end(), steeperSegment);
+		}
+	}
+	
+	updateCutoff(collector);
+}
+
+void collectRowSegments(SegmentCollector* collector, const ResultGrid& results, int row)
+{
+	int width = options.arrayWidth;
+	
+	//a segment exactly as steep as the cutoff can still get into the heap if it comes earlier than the one at the front
+	for (int j = 0; j < width; j++)
+	{
+		float angle = results.angle(row, j);
+		
+		if (fabsf(angle) >= collector->cutoff)
+			collectSegment(collector, row, j, angle, results.distance(row, j));
+	}
+}
+
+void collectRowSegments(SegmentCollector* collector, int row, const float* distances, const float* angles)
+{
+	int width = options.arrayWidth;
+	
+	for (int j = 0; j < width; j++)
+		if (fabsf(angles[j]) >= collector->cutoff)
+			collectSegment(collector, row, j, angles[j], distances[j]);
+}
+
+void mergeSegments(vector<SlopeSegment>& steepest, vector<SlopeSegment>& hits)
+{
+	steepest.clear();
+	hits.clear();
+	
+	pthread_mutex_lock(&collectorsLock);
+	
+	for (size_t c = 0; c < segmentCollectors.size(); c++)
+	{
+		SegmentCollector* collector = segmentCollectors[c];
+		
+		steepest.insert(steepest.end(), collector->steepest.begin(), collector->steepest.end());
+		hits.insert(hits.end(), collector->hits.begin(), collector->hits.end());
+		
+		//emptied rather than freed, as they are either still owned by a live thread (OpenMP's or the pool's) or waiting
+		//in idleCollectors for the next thread to pick up
+		collector->steepest.clear();
+		collector->hits.clear();
+		updateCutoff(collector);
+	}
+	
+	pthread_mutex_unlock(&collectorsLock);
+	
+	//each thread's heap holds its own top segments, so the overall top segments are the top of all of them together
+	size_t keep = min(steepest.size(), (size_t)max(options.topSegments, 0));
+	partial_sort(steepest.begin(), steepest.begin() + keep, steepest.end(), steeperSegment);
+	steepest.resize(keep);
+	
+	//threads take rows in no particular order, so the hits are put back into grid order
+	sort(hits.begin(), hits.end(), [](const SlopeSegment& a, const SlopeSegment& b)
+	{
+		return a.row != b.row ? a.row < b.row : a.column < b.column;
+	});
+}
+
+bool writeSegments(const string& path, const vector<SlopeSegment>& segments)
+{
+	ofstream file(path.c_str(), ios::trunc);
+	
+	if (!file.is_open())
+		return false;
+	
+	//same space-separated text as array.txt, with the row, column, angle and distance of one segment on each line
+	for (size_t s = 0; s < segments.size(); s++)
+		file << segments[s].row << " " << segments[s].column << " " << segments[s].angle << " " << segments[s].distance << "\n";
+	
+	return file.good();
+}
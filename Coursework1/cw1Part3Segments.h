@@ -0,0 +1,32 @@
+//segments - the steepest segments (--top) and those steeper than a threshold (--steeper-than), picked out as rows are processed
+#ifndef CW1PART3SEGMENTS_H
+#define CW1PART3SEGMENTS_H
+
+#include "cw1Part3.h"
+
+//one segment between a point and the next point along its row, as picked out by --top or --steeper-than
+struct SlopeSegment
+{
+	int row;
+	int column;
+	float angle;
+	float distance;
+};
+
+//segments one thread has picked out of the rows it processed, merged by main() once the threads have finished
+//steepest is a heap of at most options.topSegments segments with the least steep at the front, and cutoff is the steepness
+//(absolute angle) a segment has to reach before it is looked at more closely, so most points cost a single comparison
+struct alignas(CACHE_LINE_SIZE) SegmentCollector
+{
+	vector<SlopeSegment> steepest;
+	vector<SlopeSegment> hits;
+	float cutoff;
+};
+
+SegmentCollector* segmentCollector(void); //returns the calling thread's segment collector (NULL if no segments are being picked out)
+void collectRowSegments(SegmentCollector* collector, const ResultGrid& results, int row); //picks segments out of a row of results
+void collectRowSegments(SegmentCollector* collector, int row, const float* distances, const float* angles); //as above, from separate rows
+void mergeSegments(vector<SlopeSegment>& steepest, vector<SlopeSegment>& hits); //merges and empties every thread's collector
+bool writeSegments(const string& path, const vector<SlopeSegment>& segments); //writes segments to a text file, one per line
+
+#endif
@@ -0,0 +1,407 @@
+//shards - the coordinator hands out shards over pipes, and gives the shard of any worker that fails to another worker
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "cw1Part3Shards.h"
+#include "cw1Part3Trace.h"
+#include "cw1Part3Telemetry.h"
+#include "cw1Part3OutOfCore.h"
+
+//a shard of rows handed to a worker process - the process-level equivalent of a ThreadData's row range
+//the coordinator sends one to a worker to assign it rows (rowsToProcess == 0 tells the worker to exit),
+//and the worker sends the same shard back once all of its rows have been written to the results grid
+struct ShardMessage
+{
+	int currentRow;
+	int rowsToProcess;
+};
+
+//one worker process, as seen by the coordinator
+struct ShardWorker
+{
+	pid_t pid;
+	
+	//pipes used to send shards to the worker and to hear back from it
+	int toWorker;
+	int fromWorker;
+	
+	//index of the shard the worker is processing, or -1 if it is idle
+	int shard;
+	
+	int shardsCompleted;
+	bool alive;
+};
+
+//writes the pages holding a range of rows in every plane back to the file before returning
+static void syncRows(MappedGrid& grid, int firstRow, int numRows)
+{
+	for (uint32_t p = 0; p < grid.header.planes; p++)
+	{
+		size_t offset, length;
+		
+		if (rowPages(grid, p, firstRow, numRows, false, offset, length))
+			msync(grid.mapping + offset, length, MS_SYNC);
+	}
+}
+
+void runShardWorker(void)
+{
+	//the worker argument is "IN,OUT,STORE,HEIGHTS,RESULTS" - the coordinator's pipe ends, shm or file,
+	//and the names of the heights and results grids
+	vector<string> fields;
+	size_t start = 0;
+	
+	while (fields.size() < 4)
+	{
+		size_t comma = options.shardWorker.find(',', start);
+		if (comma == string::npos)
+			break;
+		
+		fields.push_back(options.shardWorker.substr(start, comma - start));
+		start = comma + 1;
+	}
+	fields.push_back(options.shardWorker.substr(start));
+	
+	if (fields.size() != 5)
+	{
+		cout << "Error! Invalid shard worker arguments \"" << options.shardWorker << "\"." << endl;
+		exit(1);
+	}
+	
+	int fromCoordinator = atoi(fields[0].c_str());
+	int toCoordinator = atoi(fields[1].c_str());
+	bool sharedMemory = fields[2] == "shm";
+	
+	//the worker attaches to the grids by name, exactly as a process on another machine would attach to a remote store
+	MappedGrid input, output;
+	if (!mapGridFile(fields[3], input, false, sharedMemory) || !mapGridFile(fields[4], output, true, sharedMemory))
+		exit(1);
+	
+	options.arrayWidth = input.header.width;
+	options.arrayHeight = input.header.height;
+	options.layout = LAYOUT_PLANES;
+	
+	ResultGrid results;
+	results.layout = LAYOUT_PLANES;
+	results.distanceArray = output.planes[0];
+	results.angleArray = output.planes[1];
+	results.pairArray = NULL;
+	
+	bool specialisedKernel;
+	RowRangeKernel kernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialisedKernel);
+	
+	if (options.kernelMode == KERNEL_LOOKUP)
+	{
+		buildSlopeTable();
+		kernel = processRowRangeLookup;
+	}
+	
+	//rows in the grids are not padded, so streaming stores (which need 16-byte alignment) can only be used if the width is a multiple of 4
+	bool streamingStores = useStreamingStores(options.stores) && options.arrayWidth % 4 == 0;
+	
+	ThreadData* data = new ThreadData[options.numThreads];
+	pthread_t* threads = new pthread_t[options.numThreads];
+	
+	for (int i = 0; i < options.numThreads; i++)
+	{
+		data[i].mainArray = input.planes[0];
+		data[i].results = results;
+		data[i].kernel = kernel;
+		data[i].streamingStores = streamingStores;
+		data[i].threadIndex = i;
+		data[i].traceBuffer = NULL;
+		data[i].lookupFallbackRows = 0;
+	}
+	
+	ShardMessage shard;
+	
+	while (read(fromCoordinator, &shard, sizeof(shard)) == sizeof(shard) && shard.rowsToProcess > 0)
+	{
+		//within the worker, the shard is split between threads just as a whole array is in a single-process run
+		int numThreads = min(options.numThreads, shard.rowsToProcess);
+		partitionRows(data, numThreads, shard.currentRow, shard.rowsToProcess);
+		
+		for (int i = 0; i < numThreads; i++)
+			pthread_create(&threads[i], NULL, processRows, (void*)&data[i]);
+		
+		for (int i = 0; i < numThreads; i++)
+			pthread_join(threads[i], NULL);
+		
+		//only report the shard as done once its results are safely in the store, so a failure after this point loses nothing
+		syncRows(output, shard.currentRow, shard.rowsToProcess);
+		
+		if (write(toCoordinator, &shard, sizeof(shard)) != sizeof(shard))
+			break;
+	}
+	
+	delete[] data;
+	delete[] threads;
+	delete[] slopeTable;
+	unmapGridFile(input);
+	unmapGridFile(output);
+}
+
+//starts a worker process running this program with the same options, plus the arguments telling it where to find its work
+//and how many threads it may use (which overrides any --threads given to the coordinator, as it comes later)
+static bool startShardWorker(ShardWorker& worker, char* argv[], int argc, int workerThreads, const string& store, const string& heights, const string& results)
+{
+	//close-on-exec pipes, so that each worker only inherits its own two pipe ends
+	//(otherwise a worker that failed would not be noticed, as other workers would still hold its pipe open)
+	int toWorker[2], fromWorker[2];
+	
+	if (pipe2(toWorker, O_CLOEXEC) == -1 || pipe2(fromWorker, O_CLOEXEC) == -1)
+		return false;
+	
+	worker.pid = fork();
+	
+	if (worker.pid == 0)
+	{
+		fcntl(toWorker[0], F_SETFD, 0);
+		fcntl(fromWorker[1], F_SETFD, 0);
+		
+		string workerArg = "--shard-worker=" + to_string(toWorker[0]) + "," + to_string(fromWorker[1]) + "," + store + "," + heights + "," + results;
+		string threadsArg = "--threads=" + to_string(workerThreads);
+		
+		vector<char*> workerArgv(argv, argv + argc);
+		workerArgv.push_back((char*)threadsArg.c_str());
+		workerArgv.push_back((char*)workerArg.c_str());
+		workerArgv.push_back(NULL);
+		
+		execv("/proc/self/exe", &workerArgv[0]);
+		_exit(127);
+	}
+	
+	close(toWorker[0]);
+	close(fromWorker[1]);
+	
+	if (worker.pid == -1)
+	{
+		close(toWorker[1]);
+		close(fromWorker[0]);
+		return false;
+	}
+	
+	worker.toWorker = toWorker[1];
+	worker.fromWorker = fromWorker[0];
+	worker.shard = -1;
+	worker.shardsCompleted = 0;
+	worker.alive = true;
+	
+	return true;
+}
+
+void runShardCoordinator(int argc, char* argv[])
+{
+	//a worker that dies while the coordinator is writing to it must not take the coordinator down with it
+	signal(SIGPIPE, SIG_IGN);
+	
+	MappedGrid input;
+	if (!mapGridFile(options.shardedPath, input))
+		exit(1);
+	
+	if (input.header.planes != 1)
+	{
+		cout << "Error! " << options.shardedPath << " holds results, not heights." << endl;
+		exit(1);
+	}
+	
+	int width = input.header.width;
+	int height = input.header.height;
+	string resultsPath = options.shardedPath + ".results";
+	
+	//with shared memory, the heights are copied into a shared memory object and the results are gathered in another,
+	//otherwise the workers map the heights file itself and write straight to the results file
+	string store = options.shardSharedMemory ? "shm" : "file";
+	string heightsName = options.shardedPath;
+	string resultsName = resultsPath;
+	
+	double setupStart = wallTime();
+	MappedGrid heights, output;
+	
+	if (options.shardSharedMemory)
+	{
+		heightsName = "/cw1Part3-" + to_string(getpid()) + "-heights";
+		resultsName = "/cw1Part3-" + to_string(getpid()) + "-results";
+		
+		if (!createGridFile(heightsName, width, height, 1, heights, true))
+			exit(1);
+		
+		memcpy(heights.planes[0][0], input.planes[0][0], (size_t)width * height * sizeof(float));
+		unmapGridFile(heights);
+	}
+	
+	if (!createGridFile(resultsName, width, height, 2, output, options.shardSharedMemory))
+		exit(1);
+	
+	double setupTime = wallTime() - setupStart;
+	
+	//rows are split into shards which are handed out one at a time, so faster workers take more of them
+	//(as threads take chunks from nextChunkRow in a single process) and a failed worker's shard can simply be handed out again
+	int shardRows = options.shardRows > 0 ? options.shardRows : max(1, height / (4 * options.numProcesses));
+	int numShards = (height + shardRows - 1) / shardRows;
+	
+	vector<int> pendingShards;
+	for (int s = numShards - 1; s >= 0; s--)
+		pendingShards.push_back(s);
+	
+	vector<ShardWorker> workers(options.numProcesses);
+	
+	//the usable CPUs are shared out between the workers, so together they run about one thread per CPU
+	int workerThreads = max(1, min(options.numThreads, availableCpuCount() / options.numProcesses));
+	
+	double start = wallTime();
+	
+	for (int w = 0; w < options.numProcesses; w++)
+	{
+		if (!startShardWorker(workers[w], argv, argc, workerThreads, store, heightsName, resultsName))
+		{
+			cout << "Error! Could not start worker process " << w << " (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+	}
+	
+	cout << "Processing " << options.shardedPath << " (" << height << " x " << width << " points) in " << numShards << " shards of "
+		<< shardRows << " rows with " << options.numProcesses << " worker processes of " << workerThreads << " threads each, using " << (options.shardSharedMemory ? "shared memory" : "file-backed") << " grids.\n";
+	
+	//the workers' rows are counted here as each shard is reported done, as the workers themselves do not sample
+	setTelemetryPhase("sharded", height);
+	WorkerProgress* progress = telemetryProgress();
+	
+	int shardsDone = 0;
+	int shardsReissued = 0;
+	int liveWorkers = options.numProcesses;
+	
+	while (shardsDone < numShards)
+	{
+		//give every idle worker a shard, if there are any left to hand out
+		for (int w = 0; w < options.numProcesses && !pendingShards.empty(); w++)
+		{
+			if (!workers[w].alive || workers[w].shard != -1)
+				continue;
+			
+			int s = pendingShards.back();
+			ShardMessage shard = { s * shardRows, min(shardRows, height - s * shardRows) };
+			
+			//a failed write means the worker has died - it is dealt with when its pipe reports the hang-up below
+			if (write(workers[w].toWorker, &shard, sizeof(shard)) == sizeof(shard))
+			{
+				workers[w].shard = s;
+				pendingShards.pop_back();
+			}
+		}
+		
+		if (liveWorkers == 0)
+		{
+			cout << "Error! Every worker process has failed, with " << (numShards - shardsDone) << " shards still to process." << endl;
+			exit(1);
+		}
+		
+		vector<pollfd> polls(options.numProcesses);
+		for (int w = 0; w < options.numProcesses; w++)
+		{
+			polls[w].fd = workers[w].alive ? workers[w].fromWorker : -1;
+			polls[w].events = POLLIN;
+			polls[w].revents = 0;
+		}
+		
+		if (poll(&polls[0], polls.size(), -1) == -1 && errno != EINTR)
+		{
+			cout << "Error! Could not wait for worker processes (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+		
+		for (int w = 0; w < options.numProcesses; w++)
+		{
+			if (polls[w].revents == 0)
+				continue;
+			
+			ShardMessage shard;
+			
+			if (read(workers[w].fromWorker, &shard, sizeof(shard)) == sizeof(shard))
+			{
+				workers[w].shard = -1;
+				workers[w].shardsCompleted++;
+				shardsDone++;
+				
+				if (progress != NULL)
+					addProgress(progress->rowsCompleted, shard.rowsToProcess);
+				continue;
+			}
+			
+			//end of file (or an error) on the pipe means the worker has exited - put its shard back to be handed out again
+			int status;
+			waitpid(workers[w].pid, &status, 0);
+			
+			workers[w].alive = false;
+			liveWorkers--;
+			close(workers[w].toWorker);
+			close(workers[w].fromWorker);
+			
+			cout << "Worker process " << w << " (pid " << workers[w].pid << ") failed";
+			if (workers[w].shard != -1)
+			{
+				int s = workers[w].shard;
+				cout << " - re-issuing rows " << (s * shardRows) << " to " << (min(height, (s + 1) * shardRows) - 1);
+				pendingShards.push_back(s);
+				shardsReissued++;
+			}
+			cout << ".\n";
+		}
+	}
+	
+	double processingTime = wallTime() - start;
+	
+	//tell the remaining workers there is nothing more to do, then wait for them to exit
+	for (int w = 0; w < options.numProcesses; w++)
+	{
+		if (!workers[w].alive)
+			continue;
+		
+		ShardMessage finished = { 0, 0 };
+		if (write(workers[w].toWorker, &finished, sizeof(finished)) != sizeof(finished))
+			cout << "Warning! Could not stop worker process " << w << "." << endl;
+		
+		close(workers[w].toWorker);
+		waitpid(workers[w].pid, NULL, 0);
+		close(workers[w].fromWorker);
+	}
+	
+	cout << "Worker | pid | shards completed\n";
+	for (int w = 0; w < options.numProcesses; w++)
+		cout << w << " | " << workers[w].pid << " | " << workers[w].shardsCompleted << (workers[w].alive ? "" : " (failed)") << "\n";
+	
+	//each point reads one float from the heights grid and writes a distance and an angle to the results grid
+	double bytesMoved = (double)height * width * sizeof(float) * 3;
+	cout << "Processing took " << processingTime << " seconds, " << (bytesMoved / processingTime / 1e9) << " GB/s, with "
+		<< shardsReissued << " shards re-issued (setting up the grids took " << setupTime << " seconds).\n";
+	
+	//results gathered in shared memory are written out to the same file a file-backed run would have produced
+	if (options.shardSharedMemory)
+	{
+		int fd = open(resultsPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		size_t written = 0;
+		
+		while (fd != -1 && written < output.mappingSize)
+		{
+			ssize_t result = write(fd, output.mapping + written, output.mappingSize - written);
+			if (result <= 0)
+				break;
+			written += result;
+		}
+		
+		if (fd == -1 || written != output.mappingSize)
+			cout << "Error! Could not write results to " << resultsPath << "." << endl;
+		
+		if (fd != -1)
+			close(fd);
+		
+		shm_unlink(heightsName.c_str());
+		shm_unlink(resultsName.c_str());
+	}
+	
+	cout << "Results written to " << resultsPath << ".\n";
+	
+	unmapGridFile(input);
+	unmapGridFile(output);
+}
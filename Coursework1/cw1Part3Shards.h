@@ -0,0 +1,10 @@
+//shards - a grid file split into shards of rows, processed by worker processes attached to it through shared memory or the file
+#ifndef CW1PART3SHARDS_H
+#define CW1PART3SHARDS_H
+
+#include "cw1Part3.h"
+
+void runShardCoordinator(int argc, char* argv[]); //splits options.shardedPath into shards and hands them to worker processes
+void runShardWorker(void); //processes the shards sent by the coordinator until told to stop
+
+#endif
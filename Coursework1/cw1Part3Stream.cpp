@@ -0,0 +1,495 @@
+//stream - a reader thread parses rows into a ring of grid rows, and workers process them in batches and write them out in order
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <deque>
+
+#include "cw1Part3Stream.h"
+#include "cw1Part3Trace.h"
+#include "cw1Part3Telemetry.h"
+#include "cw1Part3Tokenizer.h"
+
+//state shared between the thread reading a stream and the threads processing it
+//rows are numbered from 0 in the order they arrive, and row n is kept in row n % STREAM_RING_ROWS of the grids
+struct StreamState
+{
+	float** heights;
+	ResultGrid results;
+	
+	//batches of rows waiting for a thread (first row and number of rows), and whether the input has ended - guarded by lock
+	pthread_mutex_t lock;
+	pthread_cond_t batchReady;
+	pthread_cond_t rowsWritten;
+	deque< pair<int64_t, int> > batches;
+	bool finished;
+	
+	//time each row in the ring arrived, and the number of the row each slot holds once its results are done (-1 before)
+	double arrivalTimes[STREAM_RING_ROWS];
+	atomic<int64_t> completedRows[STREAM_RING_ROWS];
+	
+	//next row to write out and everything used to write it - guarded by outputLock (nextOutputRow is atomic so the
+	//reader can check how much of the ring is free without taking it)
+	pthread_mutex_t outputLock;
+	atomic<int64_t> nextOutputRow;
+	int outputFd;
+	float* outputRecord;
+	
+	//latency of every row from the moment its last byte was read to the moment its results were written out
+	vector<uint64_t> latencyBuckets;
+	double latencySum;
+	double maxLatency;
+};
+
+//data passed to each thread processing a stream
+struct StreamWorker
+{
+	StreamState* stream;
+	ThreadData threadData;
+};
+
+//writes out the results of every row that is done and has no unfinished row before it, so rows leave in the order they
+//arrived - called by each thread after every batch, so a row waits for at most the batches that arrived before it
+static void writeStreamResults(StreamState* stream)
+{
+	int width = options.arrayWidth;
+	bool wroteRows = false;
+	
+	pthread_mutex_lock(&stream->outputLock);
+	
+	while (true)
+	{
+		int64_t row = stream->nextOutputRow.load(memory_order_relaxed);
+		int slot = (int)(row % STREAM_RING_ROWS);
+		
+		if (stream->completedRows[slot].load(memory_order_acquire) != row)
+			break;
+		
+		//each record is the row's number followed by its distances and then its angles, in native byte order
+		if (stream->outputFd != -1)
+		{
+			memcpy(stream->outputRecord, &row, sizeof(row));
+			float* distances = stream->outputRecord + sizeof(row) / sizeof(float);
+			float* angles = distances + width;
+			
+			for (int j = 0; j < width; j++)
+			{
+				distances[j] = stream->results.distance(slot, j);
+				angles[j] = stream->results.angle(slot, j);
+			}
+			
+			size_t recordBytes = sizeof(row) + 2 * (size_t)width * sizeof(float);
+			if (write(stream->outputFd, stream->outputRecord, recordBytes) != (ssize_t)recordBytes)
+			{
+				cout << "Error! Could not write the results of row " << row << " (" << strerror(errno) << "), so no more will be written." << endl;
+				close(stream->outputFd);
+				stream->outputFd = -1;
+			}
+		}
+		
+		double latency = wallTime() - stream->arrivalTimes[slot];
+		int bucket = latency * 1e9 >= 1 ? (int)(log(latency * 1e9) / log(LATENCY_BUCKET_GROWTH)) : 0;
+		stream->latencyBuckets[min(bucket, LATENCY_BUCKETS - 1)]++;
+		stream->latencySum += latency;
+		stream->maxLatency = max(stream->maxLatency, latency);
+		
+		stream->nextOutputRow.store(row + 1, memory_order_release);
+		wroteRows = true;
+	}
+	
+	pthread_mutex_unlock(&stream->outputLock);
+	
+	//the reader may be waiting for a row of the ring to be free
+	if (wroteRows)
+	{
+		pthread_mutex_lock(&stream->lock);
+		pthread_cond_broadcast(&stream->rowsWritten);
+		pthread_mutex_unlock(&stream->lock);
+	}
+}
+
+static void* streamWorker(void* data)
+{
+	StreamWorker* worker = (StreamWorker*)data;
+	StreamState* stream = worker->stream;
+	ThreadData* threadData = &worker->threadData;
+	threadData->traceBuffer = traceThread("stream worker " + to_string(threadData->threadIndex));
+	
+	while (true)
+	{
+		pthread_mutex_lock(&stream->lock);
+		
+		while (stream->batches.empty() && !stream->finished)
+			pthread_cond_wait(&stream->batchReady, &stream->lock);
+		
+		if (stream->batches.empty())
+		{
+			pthread_mutex_unlock(&stream->lock);
+			break;
+		}
+		
+		pair<int64_t, int> batch = stream->batches.front();
+		stream->batches.pop_front();
+		
+		pthread_mutex_unlock(&stream->lock);
+		
+		//a batch that runs off the end of the ring is processed in two parts
+		for (int64_t row = batch.first; row < batch.first + batch.second; )
+		{
+			threadData->currentRow = (int)(row % STREAM_RING_ROWS);
+			threadData->rowsToProcess = (int)min((int64_t)(STREAM_RING_ROWS - threadData->currentRow), batch.first + batch.second - row);
+			
+			uint64_t batchTraceStart = traceTimestamp();
+			threadData->kernel(threadData);
+			traceSpan("rows", batchTraceStart, traceTimestamp(), threadData->currentRow, threadData->rowsToProcess);
+			
+			row += threadData->rowsToProcess;
+		}
+		
+		for (int64_t row = batch.first; row < batch.first + batch.second; row++)
+			stream->completedRows[row % STREAM_RING_ROWS].store(row, memory_order_release);
+		
+		writeStreamResults(stream);
+	}
+	
+	return NULL;
+}
+
+//parses one line of a stream into a row of heights, returning false if it does not hold exactly one row of numbers
+static bool parseStreamRow(const char* line, size_t length, float* heights)
+{
+	int column = 0;
+	size_t position = 0;
+	
+	while (position < length)
+	{
+		while (position < length && (line[position] == ' ' || line[position] == '\t' || line[position] == '\r'))
+			position++;
+		
+		size_t tokenStart = position;
+		while (position < length && line[position] != ' ' && line[position] != '\t' && line[position] != '\r')
+			position++;
+		
+		if (position == tokenStart)
+			break;
+		
+		bool valid;
+		if (column == options.arrayWidth)
+			return false;
+		
+		heights[column++] = parseHeight(line + tokenStart, position - tokenStart, valid);
+		
+		if (!valid)
+			return false;
+	}
+	
+	return column == options.arrayWidth;
+}
+
+//counts a line that is not a row of heights, reporting only the first so a bad stream does not flood the output
+static void skipBadLine(int64_t lineNumber, int64_t& badRows)
+{
+	if (badRows == 0)
+		cout << "Error! Skipping line " << lineNumber << " of the stream, which does not hold " << options.arrayWidth << " numbers (further bad lines are only counted)." << endl;
+	badRows++;
+}
+
+//hands the rows parsed since the last batch to the threads
+static void dispatchStreamRows(StreamState* stream, int64_t& batchStart, int64_t nextRow)
+{
+	if (nextRow == batchStart)
+		return;
+	
+	pthread_mutex_lock(&stream->lock);
+	stream->batches.push_back(make_pair(batchStart, (int)(nextRow - batchStart)));
+	pthread_cond_signal(&stream->batchReady);
+	pthread_mutex_unlock(&stream->lock);
+	
+	batchStart = nextRow;
+}
+
+//latency below which the given fraction of rows fall, taken from the middle of the bucket it lands in
+static double latencyPercentile(const vector<uint64_t>& buckets, uint64_t rows, double fraction)
+{
+	uint64_t target = (uint64_t)ceil(fraction * rows);
+	uint64_t seen = 0;
+	
+	for (int b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		seen += buckets[b];
+		if (seen >= target && seen > 0)
+			return pow(LATENCY_BUCKET_GROWTH, b + 0.5) / 1e9;
+	}
+	
+	return 0;
+}
+
+void processStream(void)
+{
+	traceThread("main");
+	
+	//the grids only hold the rows in flight, and the kernels take their height from the options
+	options.arrayHeight = STREAM_RING_ROWS;
+	
+	StreamState* stream = new StreamState;
+	stream->heights = setup2DArrayOnHeap<float>();
+	stream->results = setupResultGrid(options.layout);
+	stream->finished = false;
+	stream->nextOutputRow.store(0, memory_order_relaxed);
+	stream->outputRecord = new float[sizeof(int64_t) / sizeof(float) + 2 * options.arrayWidth];
+	stream->latencyBuckets.assign(LATENCY_BUCKETS, 0);
+	stream->latencySum = 0;
+	stream->maxLatency = 0;
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_mutex_init(&stream->outputLock, NULL);
+	pthread_cond_init(&stream->batchReady, NULL);
+	pthread_cond_init(&stream->rowsWritten, NULL);
+	
+	for (int slot = 0; slot < STREAM_RING_ROWS; slot++)
+		stream->completedRows[slot].store(-1, memory_order_relaxed);
+	
+	stream->outputFd = -1;
+	if (!options.streamOutputPath.empty())
+	{
+		stream->outputFd = open(options.streamOutputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		
+		if (stream->outputFd == -1)
+		{
+			cout << "Error! Could not open " << options.streamOutputPath << " (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+	}
+	
+	//open the input - stdin, or the first connection made to a Unix socket
+	int inputFd = STDIN_FILENO;
+	int listener = -1;
+	
+	if (options.streamPath != "-")
+	{
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		
+		if (options.streamPath.size() >= sizeof(address.sun_path))
+		{
+			cout << "Error! Socket path " << options.streamPath << " is too long." << endl;
+			exit(1);
+		}
+		strcpy(address.sun_path, options.streamPath.c_str());
+		
+		//a socket left behind by an earlier run would stop bind() from working
+		unlink(options.streamPath.c_str());
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		
+		if (listener == -1 || bind(listener, (sockaddr*)&address, sizeof(address)) == -1 || listen(listener, 1) == -1)
+		{
+			cout << "Error! Could not listen on " << options.streamPath << " (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+		
+		cout << "Waiting for rows on " << options.streamPath << "." << endl;
+		
+		while ((inputFd = accept(listener, NULL, NULL)) == -1 && errno == EINTR)
+			;
+		
+		if (inputFd == -1)
+		{
+			cout << "Error! Could not accept a connection on " << options.streamPath << " (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+	}
+	
+	bool specialisedKernel;
+	RowRangeKernel kernel = selectKernel(options.arrayWidth, options.pointSpacing, options.doublePrecision, specialisedKernel);
+	
+	if (options.kernelMode == KERNEL_LOOKUP)
+	{
+		buildSlopeTable();
+		kernel = processRowRangeLookup;
+	}
+	
+	//rows arrive a few at a time, so there is no use in more threads than CPUs to run them
+	int numThreads = min(options.numThreads, availableCpuCount());
+	StreamWorker* workers = new StreamWorker[numThreads];
+	pthread_t* threads = new pthread_t[numThreads];
+	
+	for (int i = 0; i < numThreads; i++)
+	{
+		workers[i].stream = stream;
+		workers[i].threadData.mainArray = stream->heights;
+		workers[i].threadData.results = stream->results;
+		workers[i].threadData.kernel = kernel;
+		//results are read back for writing out straight away, so they should stay in cache
+		workers[i].threadData.streamingStores = false;
+		workers[i].threadData.threadIndex = i;
+		workers[i].threadData.traceBuffer = NULL;
+		workers[i].threadData.lookupFallbackRows = 0;
+		pthread_create(&threads[i], NULL, streamWorker, (void*)&workers[i]);
+	}
+	
+	cout << "Processing rows of " << options.arrayWidth << " heights from " << (listener == -1 ? "stdin" : options.streamPath) << " as they arrive, in batches of up to "
+		<< options.streamBatchRows << " rows, with " << numThreads << " threads and " << (kernel == processRowRangeLookup ? "the lookup" : (specialisedKernel ? "a specialised" : "a generic")) << " kernel.\n";
+	setTelemetryPhase("streaming", 0);
+	
+	WorkerProgress* progress = telemetryProgress();
+	char* buffer = new char[STREAM_READ_BYTES + 1];
+	size_t used = 0;
+	int64_t nextRow = 0;
+	int64_t batchStart = 0;
+	int64_t badRows = 0;
+	int64_t lineNumber = 0;
+	double firstArrival = 0;
+	
+	//set while the rest of a line too long for the buffer is being thrown away
+	bool skippingLine = false;
+	
+	while (true)
+	{
+		ssize_t bytesRead = read(inputFd, buffer + used, STREAM_READ_BYTES - used);
+		
+		if (bytesRead == -1 && errno == EINTR)
+			continue;
+		
+		if (bytesRead == -1)
+		{
+			cout << "Error! Could not read from " << (listener == -1 ? "stdin" : options.streamPath) << " (" << strerror(errno) << ")." << endl;
+			if (listener != -1)
+				unlink(options.streamPath.c_str());
+			exit(1);
+		}
+		
+		//every line completed by this read arrived now
+		double arrival = wallTime();
+		bool ended = bytesRead == 0;
+		
+		if (bytesRead > 0)
+			used += bytesRead;
+		
+		//treat the end of the input as a final newline (in case the last row does not end with one)
+		if (ended && used > 0)
+			buffer[used++] = '\n';
+		
+		//the rest of a line that was too long is dropped up to its newline, so its tail is not parsed as a line of its own
+		if (skippingLine)
+		{
+			char* newline = (char*)memchr(buffer, '\n', used);
+			size_t skipped = newline != NULL ? newline - buffer + 1 : used;
+			
+			if (progress != NULL)
+				addProgress(progress->bytesParsed, skipped);
+			
+			memmove(buffer, buffer + skipped, used - skipped);
+			used -= skipped;
+			skippingLine = newline == NULL;
+		}
+		
+		size_t lineStart = 0;
+		char* newline;
+		
+		while ((newline = (char*)memchr(buffer + lineStart, '\n', used - lineStart)) != NULL)
+		{
+			size_t lineEnd = newline - buffer;
+			lineNumber++;
+			
+			//blank lines are skipped, as they are in array.txt
+			if (strspn(buffer + lineStart, " \t\r") < lineEnd - lineStart)
+			{
+				//wait until the results of the row last held in this row of the ring have been written out
+				if (nextRow - stream->nextOutputRow.load(memory_order_acquire) >= STREAM_RING_ROWS)
+				{
+					pthread_mutex_lock(&stream->lock);
+					while (nextRow - stream->nextOutputRow.load(memory_order_acquire) >= STREAM_RING_ROWS)
+						pthread_cond_wait(&stream->rowsWritten, &stream->lock);
+					pthread_mutex_unlock(&stream->lock);
+				}
+				
+				int slot = (int)(nextRow % STREAM_RING_ROWS);
+				
+				if (parseStreamRow(buffer + lineStart, lineEnd - lineStart, stream->heights[slot]))
+				{
+					if (nextRow == 0)
+						firstArrival = arrival;
+					
+					stream->arrivalTimes[slot] = arrival;
+					nextRow++;
+					
+					if (nextRow - batchStart == options.streamBatchRows)
+						dispatchStreamRows(stream, batchStart, nextRow);
+				}
+				else
+					skipBadLine(lineNumber, badRows);
+			}
+			
+			lineStart = lineEnd + 1;
+		}
+		
+		//every complete line has now been parsed (or skipped as a bad line)
+		if (progress != NULL)
+			addProgress(progress->bytesParsed, lineStart);
+		
+		//keep the start of any line that has not finished arriving - a line longer than the whole buffer is a bad line,
+		//and is thrown away along with the rest of it as that arrives
+		memmove(buffer, buffer + lineStart, used - lineStart);
+		used -= lineStart;
+		
+		if (used == STREAM_READ_BYTES)
+		{
+			lineNumber++;
+			skipBadLine(lineNumber, badRows);
+			
+			if (progress != NULL)
+				addProgress(progress->bytesParsed, used);
+			
+			used = 0;
+			skippingLine = true;
+		}
+		
+		//the next read may have to wait for more input, so rows already parsed are not held back for a full batch
+		dispatchStreamRows(stream, batchStart, nextRow);
+		
+		if (ended)
+			break;
+	}
+	
+	pthread_mutex_lock(&stream->lock);
+	stream->finished = true;
+	pthread_cond_broadcast(&stream->batchReady);
+	pthread_mutex_unlock(&stream->lock);
+	
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	
+	double streamTime = wallTime() - firstArrival;
+	
+	if (listener != -1)
+	{
+		close(inputFd);
+		close(listener);
+		unlink(options.streamPath.c_str());
+	}
+	
+	if (stream->outputFd != -1)
+		close(stream->outputFd);
+	
+	cout << "Processed " << nextRow << " rows (" << badRows << " bad lines skipped) in " << streamTime << " seconds from the first row arriving, "
+		<< (nextRow / streamTime) << " rows/s.\n";
+	
+	if (nextRow > 0)
+		cout << "Latency from arrival to results being written: p50 " << (latencyPercentile(stream->latencyBuckets, nextRow, 0.5) * 1e6) << " us, p99 "
+			<< (latencyPercentile(stream->latencyBuckets, nextRow, 0.99) * 1e6) << " us, mean " << (stream->latencySum / nextRow * 1e6) << " us, max "
+			<< (stream->maxLatency * 1e6) << " us.\n";
+	
+	if (!options.tracePath.empty() && !writeTrace(options.tracePath))
+		cout << "Error! Could not write trace to " << options.tracePath << "." << endl;
+	
+	delete[] buffer;
+	delete[] workers;
+	delete[] threads;
+	delete[] slopeTable;
+	delete[] stream->outputRecord;
+	delete2DArray<float>(stream->heights);
+	deleteResultGrid(stream->results);
+	pthread_mutex_destroy(&stream->lock);
+	pthread_mutex_destroy(&stream->outputLock);
+	pthread_cond_destroy(&stream->batchReady);
+	pthread_cond_destroy(&stream->rowsWritten);
+	delete stream;
+}
@@ -0,0 +1,20 @@
+//stream - rows of heights processed as they arrive on stdin or a Unix socket, with the latency of each reported
+#ifndef CW1PART3STREAM_H
+#define CW1PART3STREAM_H
+
+#include "cw1Part3.h"
+
+//number of rows of heights and results a stream keeps in flight - the reader waits for results to be written out
+//before it reuses a row, so this bounds both memory use and how far the input can run ahead of the output
+#define STREAM_RING_ROWS 1024
+
+//number of bytes a stream reads at a time (and the longest line it accepts)
+#define STREAM_READ_BYTES (1024 * 1024)
+
+//stream latencies are counted in buckets 1% wide (in nanoseconds), enough to cover up to an hour
+#define LATENCY_BUCKET_GROWTH 1.01
+#define LATENCY_BUCKETS 3000
+
+void processStream(void); //processes rows from options.streamPath as they arrive, reporting the latency of each
+
+#endif
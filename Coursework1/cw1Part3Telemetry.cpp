@@ -0,0 +1,256 @@
+//telemetry - every thread counts its own progress, and a sampler thread adds the counts up and reports them every interval
+#include "cw1Part3Telemetry.h"
+
+//progress counters of every thread that has done any work, in the order they were first used - guarded by
+//telemetryLock, which is only taken when a thread first asks for its counters and when the sampler reads the list
+//counters are kept after their threads finish, so that the totals still include every row processed
+static vector<WorkerProgress*> telemetryWorkers;
+static pthread_mutex_t telemetryLock = PTHREAD_MUTEX_INITIALIZER;
+
+//counters whose threads have finished, handed to the next thread that asks for some - guarded by telemetryLock
+//the counts in them are carried on rather than reset, so the totals never go backwards
+static vector<WorkerProgress*> idleProgress;
+
+//counters belonging to the calling thread (NULL until telemetryProgress() is first called, or if telemetry is off)
+static thread_local WorkerProgress* currentProgress = NULL;
+
+//hands the calling thread's counters back when the thread exits, so short-lived pthread workers do not each add a block
+struct ProgressRelease
+{
+	~ProgressRelease()
+	{
+		if (currentProgress == NULL)
+			return;
+		
+		pthread_mutex_lock(&telemetryLock);
+		idleProgress.push_back(currentProgress);
+		pthread_mutex_unlock(&telemetryLock);
+		
+		currentProgress = NULL;
+	}
+};
+static thread_local ProgressRelease progressRelease;
+
+//whether telemetryProgress() hands out counters - turned on by startTelemetry(), and switched by setTelemetryCounting()
+//while calibration measures what the counters cost, so the sampler's interval is never changed while it is running
+static atomic<bool> telemetryCounting(false);
+
+//what the program is doing now and how many rows it will process in all (0 if not known), set by setTelemetryPhase()
+static atomic<const char*> telemetryPhase("starting");
+static atomic<uint64_t> telemetryRowsTarget(0);
+
+//the sampler thread waits on telemetryWake between samples, so that stopping it does not have to wait out an interval
+static pthread_t telemetryThread;
+static pthread_cond_t telemetryWake;
+static bool telemetryRunning = false;
+static bool telemetryStopping = false;
+
+WorkerProgress* telemetryProgress(void)
+{
+	if (!telemetryCounting.load(memory_order_relaxed))
+		return NULL;
+	
+	if (currentProgress == NULL)
+	{
+		WorkerProgress* progress;
+		
+		pthread_mutex_lock(&telemetryLock);
+		
+		//touching the thread-local release object makes sure it is constructed, so that its destructor runs at thread exit
+		(void)&progressRelease;
+		
+		if (!idleProgress.empty())
+		{
+			progress = idleProgress.back();
+			idleProgress.pop_back();
+		}
+		else
+		{
+			progress = new WorkerProgress;
+			progress->rowsCompleted.store(0, memory_order_relaxed);
+			progress->bytesParsed.store(0, memory_order_relaxed);
+			telemetryWorkers.push_back(progress);
+		}
+		
+		pthread_mutex_unlock(&telemetryLock);
+		
+		currentProgress = progress;
+	}
+	
+	return currentProgress;
+}
+
+void setTelemetryCounting(bool counting)
+{
+	telemetryCounting.store(counting, memory_order_relaxed);
+}
+
+void setTelemetryPhase(const char* phase, uint64_t rowsTarget)
+{
+	telemetryPhase.store(phase, memory_order_relaxed);
+	telemetryRowsTarget.store(rowsTarget, memory_order_relaxed);
+}
+
+//totals of every thread's counters at one moment, and how many threads moved on since the previous sample
+struct TelemetrySample
+{
+	double time;
+	uint64_t rowsCompleted;
+	uint64_t bytesParsed;
+	size_t workers;
+	size_t activeWorkers;
+};
+
+//writes a sample in the Prometheus text exposition format to a temporary file, then renames it over the snapshot,
+//so anything scraping the snapshot (which can be kept in /dev/shm) never sees a half-written file
+static void writeTelemetrySnapshot(const TelemetrySample& sample, double rowsPerSecond, double bytesPerSecond)
+{
+	string temporaryPath = options.telemetryPath + ".tmp";
+	ofstream snapshot(temporaryPath.c_str(), ios::trunc);
+	
+	if (!snapshot.is_open())
+		return;
+	
+	snapshot << "# HELP cw1_rows_completed_total Rows processed by every thread since the program started.\n"
+		<< "# TYPE cw1_rows_completed_total counter\n"
+		<< "cw1_rows_completed_total " << sample.rowsCompleted << "\n"
+		<< "# HELP cw1_rows_target Rows the program will process in all (0 if not known).\n"
+		<< "# TYPE cw1_rows_target gauge\n"
+		<< "cw1_rows_target " << telemetryRowsTarget.load(memory_order_relaxed) << "\n"
+		<< "# HELP cw1_bytes_parsed_total Bytes of input text parsed since the program started.\n"
+		<< "# TYPE cw1_bytes_parsed_total counter\n"
+		<< "cw1_bytes_parsed_total " << sample.bytesParsed << "\n"
+		<< "# HELP cw1_rows_per_second Rows processed per second over the last sample interval.\n"
+		<< "# TYPE cw1_rows_per_second gauge\n"
+		<< "cw1_rows_per_second " << rowsPerSecond << "\n"
+		<< "# HELP cw1_bytes_parsed_per_second Bytes parsed per second over the last sample interval.\n"
+		<< "# TYPE cw1_bytes_parsed_per_second gauge\n"
+		<< "cw1_bytes_parsed_per_second " << bytesPerSecond << "\n"
+		<< "# HELP cw1_workers Threads that have reported progress, and those that made progress in the last interval.\n"
+		<< "# TYPE cw1_workers gauge\n"
+		<< "cw1_workers{state=\"registered\"} " << sample.workers << "\n"
+		<< "cw1_workers{state=\"active\"} " << sample.activeWorkers << "\n"
+		<< "# HELP cw1_phase What the program is doing now.\n"
+		<< "# TYPE cw1_phase gauge\n"
+		<< "cw1_phase{phase=\"" << telemetryPhase.load(memory_order_relaxed) << "\"} 1\n"
+		<< "# HELP cw1_elapsed_seconds Seconds since telemetry started.\n"
+		<< "# TYPE cw1_elapsed_seconds gauge\n"
+		<< "cw1_elapsed_seconds " << sample.time << "\n";
+	
+	snapshot.close();
+	
+	if (snapshot.good())
+		rename(temporaryPath.c_str(), options.telemetryPath.c_str());
+}
+
+static void* sampleTelemetry(void*)
+{
+	double start = wallTime();
+	
+	//each thread's row count at the previous sample, used to tell which threads are still making progress
+	vector<uint64_t> previousRows;
+	vector<WorkerProgress*> workers;
+	TelemetrySample previous = { 0, 0, 0, 0, 0 };
+	int samples = 0;
+	bool stopping = false;
+	
+	while (!stopping)
+	{
+		//wait for the next sample to be due, or for the program to finish (in which case one last sample is taken)
+		timespec wakeTime;
+		clock_gettime(CLOCK_MONOTONIC, &wakeTime);
+		double wake = wakeTime.tv_sec + wakeTime.tv_nsec / 1e9 + options.telemetryInterval;
+		wakeTime.tv_sec = (time_t)wake;
+		wakeTime.tv_nsec = (long)((wake - wakeTime.tv_sec) * 1e9);
+		
+		pthread_mutex_lock(&telemetryLock);
+		
+		while (!telemetryStopping && pthread_cond_timedwait(&telemetryWake, &telemetryLock, &wakeTime) == 0)
+			;
+		
+		stopping = telemetryStopping;
+		
+		//the counters are never freed, so they stay valid after the lock is released (unlike the list itself)
+		workers.assign(telemetryWorkers.begin(), telemetryWorkers.end());
+		size_t numWorkers = workers.size();
+		
+		pthread_mutex_unlock(&telemetryLock);
+		
+		TelemetrySample sample = { wallTime() - start, 0, 0, numWorkers, 0 };
+		previousRows.resize(numWorkers, 0);
+		
+		for (size_t i = 0; i < numWorkers; i++)
+		{
+			uint64_t rows = workers[i]->rowsCompleted.load(memory_order_relaxed);
+			
+			sample.rowsCompleted += rows;
+			sample.bytesParsed += workers[i]->bytesParsed.load(memory_order_relaxed);
+			
+			if (rows != previousRows[i])
+				sample.activeWorkers++;
+			previousRows[i] = rows;
+		}
+		
+		double interval = sample.time - previous.time;
+		double rowsPerSecond = interval > 0 ? (sample.rowsCompleted - previous.rowsCompleted) / interval : 0;
+		double bytesPerSecond = interval > 0 ? (sample.bytesParsed - previous.bytesParsed) / interval : 0;
+		uint64_t rowsTarget = telemetryRowsTarget.load(memory_order_relaxed);
+		
+		//stderr is unbuffered and separate from the results on stdout, so the lines appear as they happen
+		fprintf(stderr, "Telemetry %.1fs: %s, %llu", sample.time, telemetryPhase.load(memory_order_relaxed), (unsigned long long)sample.rowsCompleted);
+		if (rowsTarget > 0)
+			fprintf(stderr, " of %llu rows (%.1f%%)", (unsigned long long)rowsTarget, 100.0 * sample.rowsCompleted / rowsTarget);
+		else
+			fprintf(stderr, " rows");
+		fprintf(stderr, ", %.0f rows/s, %.1fMB parsed (%.1fMB/s), %zu of %zu threads active.\n",
+			rowsPerSecond, sample.bytesParsed / 1e6, bytesPerSecond / 1e6, sample.activeWorkers, sample.workers);
+		
+		if (!options.telemetryPath.empty())
+			writeTelemetrySnapshot(sample, rowsPerSecond, bytesPerSecond);
+		
+		previous = sample;
+		samples++;
+	}
+	
+	//the sampler's own CPU time is its whole cost to the run, as the workers' counter updates are plain stores
+	timespec cpuTime;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+	fprintf(stderr, "Telemetry took %d samples using %.3f ms of CPU time (%.4f%% of the %.1f seconds it ran for).\n", samples,
+		(cpuTime.tv_sec + cpuTime.tv_nsec / 1e9) * 1e3, 100.0 * (cpuTime.tv_sec + cpuTime.tv_nsec / 1e9) / previous.time, previous.time);
+	
+	return NULL;
+}
+
+//registered with atexit() by startTelemetry(), so the sampler always takes its last sample however the program finishes
+static void stopTelemetry(void)
+{
+	if (!telemetryRunning)
+		return;
+	
+	pthread_mutex_lock(&telemetryLock);
+	telemetryStopping = true;
+	pthread_cond_signal(&telemetryWake);
+	pthread_mutex_unlock(&telemetryLock);
+	
+	pthread_join(telemetryThread, NULL);
+	telemetryRunning = false;
+}
+
+void startTelemetry(void)
+{
+	if (options.telemetryInterval <= 0 || telemetryRunning)
+		return;
+	
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&telemetryWake, &attributes);
+	pthread_condattr_destroy(&attributes);
+	
+	telemetryStopping = false;
+	telemetryCounting.store(true, memory_order_relaxed);
+	telemetryRunning = pthread_create(&telemetryThread, NULL, sampleTelemetry, NULL) == 0;
+	
+	if (telemetryRunning)
+		atexit(stopTelemetry);
+}
@@ -0,0 +1,34 @@
+//telemetry - per-thread progress counters, sampled by a background thread and reported while the program runs
+#ifndef CW1PART3TELEMETRY_H
+#define CW1PART3TELEMETRY_H
+
+#include "cw1Part3.h"
+
+//seconds between telemetry samples if --telemetry is given without an interval
+#define DEFAULT_TELEMETRY_INTERVAL 1.0
+
+//number of times calibration runs its fastest settings with the telemetry counters on and then off, to measure what
+//they cost the kernels (the fastest run of each is kept)
+#define TELEMETRY_OVERHEAD_REPEATS 10
+
+//progress counters of one thread, read by the telemetry sampler while the thread is still running
+//only the owning thread ever writes them (with relaxed atomics, so an update is a plain load, add and store), and each
+//object fills a cache line of its own so that one thread's updates never invalidate the line another thread is writing
+struct alignas(CACHE_LINE_SIZE) WorkerProgress
+{
+	atomic<uint64_t> rowsCompleted;
+	atomic<uint64_t> bytesParsed;
+};
+
+WorkerProgress* telemetryProgress(void); //returns the calling thread's progress counters (NULL if telemetry is off)
+void startTelemetry(void); //starts the telemetry sampler thread, which is stopped when the program exits
+void setTelemetryCounting(bool counting); //turns the handing out of progress counters on or off, whether or not the sampler is running
+void setTelemetryPhase(const char* phase, uint64_t rowsTarget); //names what the program is doing now, and how many rows it will process in all
+
+//adds to a progress counter which only the calling thread writes - no atomic read-modify-write is needed
+static inline void addProgress(atomic<uint64_t>& counter, uint64_t amount)
+{
+	counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,208 @@
+//tokenizer - array.txt is read in one go, then split into values a chunk of PARSE_CHUNK_SIZE bytes at a time
+#include "cw1Part3Tokenizer.h"
+#include "cw1Part3Telemetry.h"
+
+//returns a mask with bit i set if text[i] is a space, newline or carriage return, for the PARSE_CHUNK_SIZE bytes at text
+//the bytes are compared 32 (AVX2) or 16 (SSE2) at a time rather than one by one
+static inline uint64_t delimiterMask(const char* text)
+{
+	uint64_t mask = 0;
+	
+#if defined(__AVX2__)
+	for (int offset = 0; offset < PARSE_CHUNK_SIZE; offset += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(text + offset));
+		__m256i delimiters = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\r'))));
+		mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(delimiters) << offset;
+	}
+#elif defined(__SSE2__)
+	for (int offset = 0; offset < PARSE_CHUNK_SIZE; offset += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(text + offset));
+		__m128i delimiters = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+		mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(delimiters) << offset;
+	}
+#else
+	for (int offset = 0; offset < PARSE_CHUNK_SIZE; offset++)
+		if (text[offset] == ' ' || text[offset] == '\n' || text[offset] == '\r')
+			mask |= (uint64_t)1 << offset;
+#endif
+	
+	return mask;
+}
+
+//general fallback for values not in the format written by generateRandomNumberFile (e.g. negative or in scientific notation)
+//strtof() rounds correctly, but needs a null-terminated copy of the value
+float parseHeightGeneral(const char* token, size_t length, bool& valid)
+{
+	char copy[64];
+	
+	if (length >= sizeof(copy))
+	{
+		valid = false;
+		return 0;
+	}
+	
+	memcpy(copy, token, length);
+	copy[length] = '\0';
+	
+	char* end;
+	float value = strtof(copy, &end);
+	valid = (end == copy + length);
+	
+	return value;
+}
+
+float** setupMainArray(void)
+{
+	//read the whole of array.txt into memory in one go
+	int fd = open("array.txt", O_RDONLY);
+	struct stat fileInfo;
+	
+	if (fd == -1 || fstat(fd, &fileInfo) == -1)
+	{
+		cout << "Error! Could not open array.txt (" << strerror(errno) << ")." << endl;
+		exit(1);
+	}
+	
+	size_t length = fileInfo.st_size;
+	
+	//extra space at the end lets delimiterMask() read a whole chunk past the last byte of the file
+	char* text = new char[length + PARSE_CHUNK_SIZE];
+	memset(text + length, 0, PARSE_CHUNK_SIZE);
+	
+	size_t bytesRead = 0;
+	while (bytesRead < length)
+	{
+		ssize_t result = read(fd, text + bytesRead, length - bytesRead);
+		
+		if (result <= 0)
+		{
+			cout << "Error! Could not read array.txt (" << strerror(errno) << ")." << endl;
+			exit(1);
+		}
+		
+		bytesRead += result;
+	}
+	close(fd);
+	
+	//main array to hold the numbers to be operated on by threads
+	float** mainArray = setup2DArrayOnHeap<float>();
+	WorkerProgress* progress = telemetryProgress();
+	size_t bytesReported = 0;
+	
+	int row = 0;
+	int column = 0;
+	size_t tokenStart = 0;
+	
+	//find the delimiters a chunk at a time, then convert the value between each pair of delimiters
+	for (size_t chunkStart = 0; chunkStart < length + 1 && row < options.arrayHeight; chunkStart += PARSE_CHUNK_SIZE)
+	{
+		uint64_t mask = delimiterMask(text + chunkStart);
+		
+		//treat the end of the file as a final newline (in case the last row does not end with one)
+		if (length - chunkStart < PARSE_CHUNK_SIZE)
+		{
+			mask &= ((uint64_t)1 << (length - chunkStart)) - 1;
+			mask |= (uint64_t)1 << (length - chunkStart);
+			text[length] = '\n';
+		}
+		
+		while (mask != 0 && row < options.arrayHeight)
+		{
+			size_t position = chunkStart + __builtin_ctzll(mask);
+			mask &= mask - 1;
+			
+			//consecutive delimiters (e.g. the space before each newline) have nothing between them
+			if (position > tokenStart)
+			{
+				if (column == options.arrayWidth)
+				{
+					cout << "Error! Row " << row << " of array.txt has more than " << options.arrayWidth << " values." << endl;
+					exit(1);
+				}
+				
+				bool valid;
+				mainArray[row][column] = parseHeight(text + tokenStart, position - tokenStart, valid);
+				
+				if (!valid)
+				{
+					cout << "Error! \"" << string(text + tokenStart, position - tokenStart) << "\" in row " << row << " of array.txt is not a number." << endl;
+					exit(1);
+				}
+				
+				column++;
+			}
+			
+			//a newline ends the row, as long as it had values in it (blank lines are skipped)
+			if (text[position] == '\n' && column != 0)
+			{
+				if (column != options.arrayWidth)
+				{
+					cout << "Error! Row " << row << " of array.txt has " << column << " values, expected " << options.arrayWidth << "." << endl;
+					exit(1);
+				}
+				
+				//the counters may have been handed on from a thread that has finished, so only the bytes since the last row are added
+				if (progress != NULL)
+				{
+					addProgress(progress->bytesParsed, position + 1 - bytesReported);
+					bytesReported = position + 1;
+				}
+				
+				row++;
+				column = 0;
+			}
+			
+			tokenStart = position + 1;
+		}
+	}
+	
+	if (row != options.arrayHeight)
+	{
+		cout << "Error! array.txt has " << row << " rows, expected " << options.arrayHeight << "." << endl;
+		exit(1);
+	}
+	
+	delete[] text;
+	
+	return mainArray;
+}
+
+void benchmarkParsers(void)
+{
+	struct stat fileInfo;
+	
+	if (stat("array.txt", &fileInfo) == -1)
+	{
+		cout << "Error! Could not open array.txt (" << strerror(errno) << ")." << endl;
+		exit(1);
+	}
+	
+	double gigabytes = fileInfo.st_size / 1e9;
+	
+	double start = wallTime();
+	float** stringArray = setupMainArrayFromStrings();
+	double stringTime = wallTime() - start;
+	
+	start = wallTime();
+	float** simdArray = setupMainArray();
+	double simdTime = wallTime() - start;
+	
+	//both loaders should give exactly the same floats, since both round correctly
+	long mismatches = 0;
+	for (int i = 0; i < options.arrayHeight; i++)
+		for (int j = 0; j < options.arrayWidth; j++)
+			if (stringArray[i][j] != simdArray[i][j])
+				mismatches++;
+	
+	cout << "String loader took " << stringTime << " seconds (" << (gigabytes / stringTime) << " GB/s).\n";
+	cout << "Chunked loader took " << simdTime << " seconds (" << (gigabytes / simdTime) << " GB/s), "
+		<< (stringTime / simdTime) << "x faster.\n";
+	cout << mismatches << " values differ between the two loaders.\n";
+	
+	delete2DArray<float>(stringArray);
+	delete2DArray<float>(simdArray);
+}
@@ -0,0 +1,54 @@
+//tokenizer - the fast loader for array.txt, which finds delimiters a chunk at a time and converts values without strtof()
+#ifndef CW1PART3TOKENIZER_H
+#define CW1PART3TOKENIZER_H
+
+#include "cw1Part3.h"
+
+//number of bytes of array.txt examined at once when looking for the spaces and newlines between values
+#define PARSE_CHUNK_SIZE 64
+
+float** setupMainArray(void); //used for importing and converting data for main array from array.txt and storing it in main array
+void benchmarkParsers(void); //times both loaders on array.txt and checks that they produce the same values
+
+float parseHeightGeneral(const char* token, size_t length, bool& valid); //converts any value strtof() accepts, for parseHeight() to fall back on
+
+//converts a single value from array.txt to a float
+//fast path for the values written by generateRandomNumberFile, which are always 1-3 digits, a point, then 1-3 digits:
+//the digits are read as one integer and divided by a power of 10 in double precision, then rounded to float
+//(both integers are exact in a double and the quotient has far fewer significant digits than a double can hold,
+//so rounding twice gives the same correctly-rounded float as strtof() would)
+static inline float parseHeight(const char* token, size_t length, bool& valid)
+{
+	static const double powersOf10[] = { 1.0, 10.0, 100.0, 1000.0 };
+	
+	if (length >= 3 && length <= 7)
+	{
+		int digits = 0;
+		int wholeDigits = -1;
+		size_t i = 0;
+		
+		for (; i < length; i++)
+		{
+			char character = token[i];
+			
+			if (character >= '0' && character <= '9')
+				digits = digits * 10 + (character - '0');
+			else if (character == '.' && wholeDigits == -1)
+				wholeDigits = (int)i;
+			else
+				break;
+		}
+		
+		int fractionDigits = (int)length - wholeDigits - 1;
+		
+		if (i == length && wholeDigits >= 1 && wholeDigits <= 3 && fractionDigits >= 1 && fractionDigits <= 3)
+		{
+			valid = true;
+			return (float)(digits / powersOf10[fractionDigits]);
+		}
+	}
+	
+	return parseHeightGeneral(token, length, valid);
+}
+
+#endif
@@ -0,0 +1,180 @@
+//tracing - each thread records spans into a buffer of its own, which are all written out together at the end of the run
+#include "cw1Part3Trace.h"
+
+//every thread's trace buffer, in the order the threads were named - guarded by traceBuffersLock
+//buffers are kept after their threads finish, so that they can all be written out at the end of the run
+static vector<TraceBuffer*> traceBuffers;
+static pthread_mutex_t traceBuffersLock = PTHREAD_MUTEX_INITIALIZER;
+
+//buffers whose threads have finished, waiting for a later thread with the same name (such as the next run's
+//"worker 0") to carry on where they left off - guarded by traceBuffersLock
+static vector<TraceBuffer*> retiredTraceBuffers;
+
+//buffer belonging to the calling thread (NULL until traceThread() is called, or if not tracing)
+static thread_local TraceBuffer* currentTraceBuffer = NULL;
+
+//hands the calling thread's buffer back when the thread exits, so that the number of buffers is bounded by the
+//number of differently named threads rather than growing with every pthread worker ever started
+struct TraceBufferRelease
+{
+	~TraceBufferRelease()
+	{
+		if (currentTraceBuffer == NULL)
+			return;
+		
+		pthread_mutex_lock(&traceBuffersLock);
+		retiredTraceBuffers.push_back(currentTraceBuffer);
+		pthread_mutex_unlock(&traceBuffersLock);
+		
+		currentTraceBuffer = NULL;
+	}
+};
+static thread_local TraceBufferRelease traceBufferRelease;
+
+//trace tick count and wall-clock time when the first thread was named, used to turn ticks into microseconds on export
+static uint64_t traceStartTicks;
+static double traceStartTime;
+
+uint64_t traceTimestamp(void)
+{
+	//reading the time stamp counter takes a few nanoseconds, against a few tens for clock_gettime()
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+TraceBuffer* traceThread(const string& name)
+{
+	if (options.tracePath.empty())
+		return NULL;
+	
+	//a thread named again with the same name (such as main() at the start of each mode) keeps its buffer
+	if (currentTraceBuffer != NULL && currentTraceBuffer->threadName == name)
+		return currentTraceBuffer;
+	
+	TraceBuffer* buffer = NULL;
+	
+	pthread_mutex_lock(&traceBuffersLock);
+	
+	//touching the thread-local release object makes sure it is constructed, so that its destructor runs at thread exit
+	(void)&traceBufferRelease;
+	
+	if (currentTraceBuffer != NULL)
+		retiredTraceBuffers.push_back(currentTraceBuffer);
+	
+	for (size_t b = 0; b < retiredTraceBuffers.size(); b++)
+	{
+		if (retiredTraceBuffers[b]->threadName == name)
+		{
+			buffer = retiredTraceBuffers[b];
+			retiredTraceBuffers.erase(retiredTraceBuffers.begin() + b);
+			break;
+		}
+	}
+	
+	if (buffer == NULL)
+	{
+		buffer = new TraceBuffer;
+		buffer->threadName = name;
+		buffer->events.resize(TRACE_BUFFER_INITIAL_EVENTS);
+		buffer->recorded = 0;
+		
+		if (traceBuffers.empty())
+		{
+			traceStartTicks = traceTimestamp();
+			traceStartTime = wallTime();
+		}
+		traceBuffers.push_back(buffer);
+	}
+	
+	pthread_mutex_unlock(&traceBuffersLock);
+	
+	currentTraceBuffer = buffer;
+	return buffer;
+}
+
+TraceBuffer* currentTrace(void)
+{
+	return currentTraceBuffer;
+}
+
+void traceSpanIn(TraceBuffer* buffer, const char* name, uint64_t start, uint64_t end, int row, int rows)
+{
+	if (buffer == NULL)
+		return;
+	
+	//grow the buffer until it reaches its full size, after which the oldest events are overwritten
+	size_t capacity = buffer->events.size();
+	if (buffer->recorded == capacity && capacity < TRACE_BUFFER_EVENTS)
+	{
+		buffer->events.resize(min(2 * capacity, (size_t)TRACE_BUFFER_EVENTS));
+		capacity = buffer->events.size();
+	}
+	
+	TraceEvent& event = buffer->events[buffer->recorded % capacity];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	event.row = row;
+	event.rows = rows;
+	
+	buffer->recorded++;
+}
+
+void traceSpan(const char* name, uint64_t start, uint64_t end, int row, int rows)
+{
+	traceSpanIn(currentTraceBuffer, name, start, end, row, rows);
+}
+
+bool writeTrace(const string& path)
+{
+	ofstream trace(path.c_str(), ios::trunc);
+	
+	if (!trace.is_open())
+		return false;
+	
+	//work out how many ticks there are in a microsecond from the ticks and wall-clock time since tracing started
+	double ticksPerMicrosecond = (traceTimestamp() - traceStartTicks) / ((wallTime() - traceStartTime) * 1e6);
+	
+	trace << "{\"traceEvents\":[\n";
+	bool first = true;
+	
+	for (size_t tid = 0; tid < traceBuffers.size(); tid++)
+	{
+		TraceBuffer* buffer = traceBuffers[tid];
+		
+		//metadata event giving the thread its name in the viewer
+		trace << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+		first = false;
+		
+		//if the buffer has wrapped around, its oldest surviving event is the one after the most recent
+		size_t capacity = buffer->events.size();
+		size_t numEvents = min(buffer->recorded, capacity);
+		size_t oldest = buffer->recorded > capacity ? buffer->recorded % capacity : 0;
+		
+		for (size_t i = 0; i < numEvents; i++)
+		{
+			const TraceEvent& event = buffer->events[(oldest + i) % capacity];
+			
+			double start = (double)(int64_t)(event.start - traceStartTicks) / ticksPerMicrosecond;
+			double duration = (double)(int64_t)(event.end - event.start) / ticksPerMicrosecond;
+			
+			trace << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << fixed << start << ",\"dur\":" << duration;
+			
+			if (event.row != -1)
+				trace << ",\"args\":{\"row\":" << event.row << ",\"rows\":" << event.rows << "}";
+			
+			trace << "}";
+		}
+	}
+	
+	trace << "\n]}\n";
+	
+	return trace.good();
+}
@@ -0,0 +1,42 @@
+//tracing - a timeline of the spans of time every thread spent on each part of the run, for --trace
+#ifndef CW1PART3TRACE_H
+#define CW1PART3TRACE_H
+
+#include "cw1Part3.h"
+
+//largest number of events kept for each thread when tracing - once a thread's buffer is full, its oldest events are overwritten
+//buffers start small and double in size as needed, so the 50000 short-lived threads of a default run only use a few events each
+#define TRACE_BUFFER_EVENTS 65536
+#define TRACE_BUFFER_INITIAL_EVENTS 16
+
+//one span of time recorded by a thread when tracing - timestamps are in ticks of traceTimestamp()
+struct TraceEvent
+{
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+	
+	//first row and number of rows the span covers (-1 and 0 for spans that are not about rows)
+	int row;
+	int rows;
+};
+
+//ring buffer of the events recorded by one thread - only ever written by the thread that owns it (or by main() once
+//that thread has been joined), so recording an event needs no locking
+struct TraceBuffer
+{
+	string threadName;
+	vector<TraceEvent> events;
+	
+	//total number of events ever recorded - once this passes the capacity, events wrap around and overwrite the oldest
+	size_t recorded;
+};
+
+uint64_t traceTimestamp(void); //current time in trace ticks (the CPU's time stamp counter where available)
+TraceBuffer* traceThread(const string& name); //names the calling thread in the trace and returns its buffer (NULL if not tracing)
+TraceBuffer* currentTrace(void); //returns the calling thread's buffer (NULL if it has not been named yet, or if not tracing)
+void traceSpan(const char* name, uint64_t start, uint64_t end, int row = -1, int rows = 0); //records a span for the calling thread
+void traceSpanIn(TraceBuffer* buffer, const char* name, uint64_t start, uint64_t end, int row = -1, int rows = 0); //records a span in a given buffer
+bool writeTrace(const string& path); //writes every thread's events to a trace-event JSON file
+
+#endif
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <pthread.h>
+#include <time.h>
+#include <cstdlib>
+
+using namespace std;
+
+//microbenchmark showing the cost of false sharing between threads in cw1Part3
+//compares per-thread slots packed next to each other against slots padded out to a cache line,
+//and output rows of 1000 floats laid end to end against rows padded out to a whole number of cache lines
+
+//size of a cache line in bytes
+#define CACHE_LINE_SIZE 64
+
+//width of a row of the result grids in cw1Part3
+#define ARRAY_WIDTH 1000
+
+//row width rounded up to a whole number of cache lines (what floatRowStride in cw1Part3 works out to for a width of 1000)
+#define PADDED_ROW_STRIDE 1008
+
+//number of times each thread updates its slot or rewrites its row
+#define SLOT_ITERATIONS 20000000
+#define ROW_ITERATIONS 20000
+
+//largest number of threads tested - thread counts double from 1 up to this value
+#define MAX_THREADS 256
+
+//slot which is only as big as the value it holds, so up to 16 of them share a cache line
+struct PackedSlot
+{
+	float value;
+};
+
+//slot which fills a whole cache line, so no two threads ever write to the same line
+struct alignas(CACHE_LINE_SIZE) PaddedSlot
+{
+	float value;
+};
+
+//data passed to each thread
+struct BenchmarkThreadData
+{
+	//slot-based tests: pointer to the value this thread accumulates into
+	volatile float* slot;
+
+	//row-based tests: start of the row this thread writes to
+	float* row;
+
+	int iterations;
+};
+
+//each thread adds to its own slot - the volatile pointer forces every addition to be written back to memory,
+//as the timeTaken and accumulator writes in cw1Part3 would be if they were updated inside the loop
+void* accumulateIntoSlot(void* data)
+{
+	BenchmarkThreadData* threadData = (BenchmarkThreadData*)data;
+
+	for (int i = 0; i < threadData->iterations; i++)
+		*threadData->slot += 1.0f;
+
+	return NULL;
+}
+
+//each thread repeatedly rewrites every value in its own row (as processRows does for a range of one row)
+void* writeRow(void* data)
+{
+	BenchmarkThreadData* threadData = (BenchmarkThreadData*)data;
+	volatile float* row = threadData->row;
+
+	for (int i = 0; i < threadData->iterations; i++)
+		for (int j = 0; j < ARRAY_WIDTH; j++)
+			row[j] = (float)(i + j);
+
+	return NULL;
+}
+
+//wall-clock time in seconds (clock() would add together the CPU time of every thread)
+double wallTime(void)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//allocates a block aligned to a cache line, rounding its size up to a whole number of cache lines as aligned_alloc() requires
+float* allocateRows(size_t bytes)
+{
+	size_t roundedBytes = ((bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+	float* rows = (float*)aligned_alloc(CACHE_LINE_SIZE, roundedBytes);
+
+	if (rows == NULL)
+	{
+		cout << "Error! Could not allocate " << roundedBytes << " bytes for the benchmark rows." << endl;
+		exit(1);
+	}
+
+	return rows;
+}
+
+//runs the given thread function once for each of numThreads threads and returns the wall-clock time taken
+double runThreads(void* (*function)(void*), BenchmarkThreadData* data, int numThreads)
+{
+	pthread_t threads[MAX_THREADS];
+
+	double start = wallTime();
+
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, function, (void*)&data[i]);
+
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+
+	return wallTime() - start;
+}
+
+int main ()
+{
+	PackedSlot* packedSlots = new PackedSlot[MAX_THREADS];
+	PaddedSlot* paddedSlots = new PaddedSlot[MAX_THREADS];
+
+	//one row per thread, both grids aligned to a cache line so that only the row stride differs between them
+	float* packedRows = allocateRows(MAX_THREADS * ARRAY_WIDTH * sizeof(float));
+	float* paddedRows = allocateRows(MAX_THREADS * PADDED_ROW_STRIDE * sizeof(float));
+
+	BenchmarkThreadData data[MAX_THREADS];
+
+	cout << "Threads | packed slots (s) | padded slots (s) | speedup | packed rows (s) | padded rows (s) | speedup\n";
+
+	for (int numThreads = 1; numThreads <= MAX_THREADS; numThreads *= 2)
+	{
+		//spread a fixed total amount of work between the threads so that times are comparable between thread counts
+		int slotIterations = SLOT_ITERATIONS / numThreads;
+		int rowIterations = ROW_ITERATIONS / numThreads;
+
+		for (int i = 0; i < numThreads; i++)
+		{
+			packedSlots[i].value = 0;
+			data[i].slot = &packedSlots[i].value;
+			data[i].iterations = slotIterations;
+		}
+		double packedSlotTime = runThreads(accumulateIntoSlot, data, numThreads);
+
+		for (int i = 0; i < numThreads; i++)
+		{
+			paddedSlots[i].value = 0;
+			data[i].slot = &paddedSlots[i].value;
+		}
+		double paddedSlotTime = runThreads(accumulateIntoSlot, data, numThreads);
+
+		for (int i = 0; i < numThreads; i++)
+		{
+			data[i].row = packedRows + i * ARRAY_WIDTH;
+			data[i].iterations = rowIterations;
+		}
+		double packedRowTime = runThreads(writeRow, data, numThreads);
+
+		for (int i = 0; i < numThreads; i++)
+			data[i].row = paddedRows + i * PADDED_ROW_STRIDE;
+		double paddedRowTime = runThreads(writeRow, data, numThreads);
+
+		cout << numThreads << " | " << packedSlotTime << " | " << paddedSlotTime << " | " << (packedSlotTime / paddedSlotTime) << "x | "
+			<< packedRowTime << " | " << paddedRowTime << " | " << (packedRowTime / paddedRowTime) << "x\n";
+	}
+
+	delete[] packedSlots;
+	delete[] paddedSlots;
+	free(packedRows);
+	free(paddedRows);
+
+	return 0;
+}